@@ -0,0 +1,36 @@
+#!/bin/sh
+# Measures how many rows per second jfilter evaluates on a synthetic stream with two random integer
+# columns (see gen_ints.py), for a few typical expressions. Prints the best time of three runs.
+#
+# Usage: bench/filter_rate.sh [BIN_DIR=.] [ROWS=100000000]
+
+set -e
+
+bin=${1:-.}
+rows=${2:-100000000}
+
+data=${TMPDIR:-/tmp}/jutils-bench
+mkdir -p "$data"
+input=$data/ints-$rows.v2
+[ -f "$input" ] || python3 "$(dirname "$0")/gen_ints.py" "$rows" > "$input"
+
+# Prints the best wall time of three runs in seconds
+best() {
+    for run in 1 2 3; do
+        start=$(date +%s.%N)
+        "$@" < "$input" > /dev/null
+        end=$(date +%s.%N)
+        awk -v s="$start" -v e="$end" 'BEGIN { print e - s }'
+    done | sort -n | head -n 1
+}
+
+echo "jfilter on $rows rows"
+# rss is below 2^24, so the second expression matches about 10% of the rows
+for expr in "port == 443" "rss > 15000000" "port >= 1024 and rss < 500000" \
+    "port == 443 or port == 80" "not port < 1024"; do
+    # The expression is split into words on purpose
+    # shellcheck disable=SC2086
+    time=$(best "$bin"/jfilter $expr)
+    awk -v e="$expr" -v t="$time" -v r="$rows" \
+        'BEGIN { printf "%-32s %7.3f s  %6.1fM rows/s\n", e, t, r / t / 1e6 }'
+done
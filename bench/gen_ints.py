@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+# Writes a synthetic version 2 stream with two random integer columns to stdout: `port` (0-65535)
+# and `rss` (0-16777215). The values are the same for the same row count.
+#
+# Usage: bench/gen_ints.py ROWS > ints.v2
+
+import random
+import struct
+import sys
+
+BLOCK_ROWS = 4096
+
+
+def column(rng, rows, value_bytes):
+    # Plain encoding (0) followed by little-endian i64s, of which only the low bytes are random
+    data = bytearray(rng.randbytes(rows * 8))
+    for byte in range(value_bytes, 8):
+        data[byte::8] = bytes(rows)
+    return b"\x00" + data
+
+
+def main():
+    rows = int(sys.argv[1])
+    rng = random.Random(1)
+    out = sys.stdout.buffer
+    out.write(b"\xe9SIO" + struct.pack("<IBI", 0xFFFFFFFF, 2, 0))
+    out.write(struct.pack("<I", 2))
+    for name in (b"port", b"rss"):
+        out.write(struct.pack("<BH", 1, len(name)) + name)
+    while rows > 0:
+        num = min(rows, BLOCK_ROWS)
+        payload = column(rng, num, 2) + column(rng, num, 3)
+        out.write(b"\xe9BLK" + struct.pack("<II", num, len(payload)) + payload)
+        rows -= num
+
+
+main()
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Counts the write(2) calls per output row with `strace -c`, for jparse on a synthetic CSV and for
+# jps --all. Pass the directories with the jutils symlinks of the builds to compare, e.g.
+#
+#   bench/output_syscalls.sh build-before build-after
+#
+# Usage: bench/output_syscalls.sh [ROWS=100000] BIN_DIR...
+
+set -e
+
+if ! command -v strace >/dev/null; then
+    echo "strace is required" >&2
+    exit 1
+fi
+
+rows=100000
+case "$1" in
+[0-9]*)
+    rows=$1
+    shift
+    ;;
+esac
+[ $# -gt 0 ] || set -- .
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+seq "$rows" | awk '{ print "foo" $1 ";bar" $1 ";baz" $1 ";bat" $1 ";bla" $1 }' > "$tmp/input.csv"
+
+# Prints the number of write(2) calls of a command and per row
+count() {
+    numRows=$1
+    shift
+    strace -f -c -e trace=write -o "$tmp/summary" "$@" > /dev/null
+    # The columns are: % time, seconds, usecs/call, calls, errors (often empty), syscall
+    writes=$(awk '$NF == "write" { print $4 }' "$tmp/summary")
+    awk -v w="${writes:-0}" -v r="$numRows" \
+        'BEGIN { printf "%10d writes  %10.5f per row\n", w, w / r }'
+}
+
+for bin in "$@"; do
+    echo "== $bin"
+    printf '%-12s' "jparse:"
+    count "$rows" "$bin"/jparse -c ";" c1 c2 c3 c4 c5 < "$tmp/input.csv"
+    # One row per process (roughly, processes come and go)
+    printf '%-12s' "jps --all:"
+    count "$(ls -d /proc/[0-9]* | wc -l)" "$bin"/jps --all
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Measures how jsort --threads scales: sorts a synthetic stream (see gen_ints.py) by `rss` with
+# 1, 2, 4, ... threads up to the number of cores and prints the best time of three runs and the
+# speedup over a single thread.
+#
+# Usage: bench/sort_threads.sh [BIN_DIR=.] [ROWS=10000000] [MAX_THREADS=$(nproc)]
+
+set -e
+
+bin=${1:-.}
+rows=${2:-10000000}
+maxThreads=${3:-$(nproc)}
+
+data=${TMPDIR:-/tmp}/jutils-bench
+mkdir -p "$data"
+input=$data/ints-$rows.v2
+[ -f "$input" ] || python3 "$(dirname "$0")/gen_ints.py" "$rows" > "$input"
+
+# Prints the best wall time of three runs in seconds
+best() {
+    for run in 1 2 3; do
+        start=$(date +%s.%N)
+        "$@" < "$input" > /dev/null
+        end=$(date +%s.%N)
+        awk -v s="$start" -v e="$end" 'BEGIN { print e - s }'
+    done | sort -n | head -n 1
+}
+
+echo "jsort rss on $rows rows, $(nproc) cores"
+threads=1
+while :; do
+    time=$(best "$bin"/jsort --threads "$threads" rss)
+    [ "$threads" -eq 1 ] && single=$time
+    awk -v n="$threads" -v t="$time" -v s="$single" \
+        'BEGIN { printf "threads %3d: %7.3f s  speedup %5.2f\n", n, t, s / t }'
+    [ "$threads" -ge "$maxThreads" ] && break
+    threads=$((threads * 2))
+    [ "$threads" -gt "$maxThreads" ] && threads=$maxThreads
+done
@@ -0,0 +1,755 @@
+#include "expr.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JUTILS_X86 1
+#endif
+
+#include "util.hpp"
+
+struct Filter::Node {
+    enum class Kind {
+        Const,
+        Condition,
+        Not,
+        And,
+        Or,
+    };
+
+    Kind kind;
+    bool value = false;
+    Instruction condition {};
+    std::unique_ptr<Node> lhs;
+    std::unique_ptr<Node> rhs;
+    // There are only string conditions in this subtree. evalBatch tests them row by row, so every
+    // string is only loaded once (instead of once per condition).
+    bool rowWise = false;
+    // The instructions of this subtree in program_
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+namespace {
+[[noreturn]] void invalidExpression(const std::string& message)
+{
+    std::cerr << "Invalid expression: " << message << std::endl;
+    std::exit(4);
+}
+
+std::optional<int64_t> parseInt(const std::string& str)
+{
+    int64_t value = 0;
+    const auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (res.ec != std::errc() || res.ptr != str.data() + str.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+// "a,b,c" -> {"a", "b", "c"}
+std::vector<std::string> splitList(const std::string& str)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (true) {
+        const auto comma = str.find(',', start);
+        items.push_back(str.substr(start, comma - start));
+        if (comma == std::string::npos) {
+            return items;
+        }
+        start = comma + 1;
+    }
+}
+
+std::vector<std::string> tokenize(const std::string& expression)
+{
+    std::vector<std::string> tokens;
+    std::string token;
+    bool inToken = false;
+    char quote = 0;
+    for (const auto c : expression) {
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            } else {
+                token.push_back(c);
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            inToken = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (inToken) {
+                tokens.push_back(std::move(token));
+                token.clear();
+                inToken = false;
+            }
+        } else {
+            token.push_back(c);
+            inToken = true;
+        }
+    }
+    if (quote) {
+        invalidExpression("missing closing quote");
+    }
+    if (inToken) {
+        tokens.push_back(std::move(token));
+    }
+    return tokens;
+}
+
+// Batch kernels: selection[i] is set to 0 unless `values[i] <cmp> value` (negated if `invert`)
+enum class Cmp {
+    Eq,
+    Gt,
+    Lt,
+};
+
+template <Cmp C>
+bool compare(int64_t a, int64_t b)
+{
+    return C == Cmp::Eq ? a == b : C == Cmp::Gt ? a > b : a < b;
+}
+
+template <Cmp C>
+void selectScalar(const int64_t* values, size_t count, int64_t value, bool invert,
+    uint8_t* selection, size_t start = 0)
+{
+    for (size_t i = start; i < count; ++i) {
+        selection[i] &= compare<C>(values[i], value) != invert;
+    }
+}
+
+#ifdef JUTILS_X86
+// Maps the result bits of 4 comparisons to a mask of 4 bytes
+constexpr uint32_t expandBits(uint32_t bits)
+{
+    return (bits & 1 ? 0xffu : 0) | (bits & 2 ? 0xff00u : 0) | (bits & 4 ? 0xff0000u : 0)
+        | (bits & 8 ? 0xff000000u : 0);
+}
+
+constexpr uint32_t byteMasks[16] = {
+    expandBits(0),
+    expandBits(1),
+    expandBits(2),
+    expandBits(3),
+    expandBits(4),
+    expandBits(5),
+    expandBits(6),
+    expandBits(7),
+    expandBits(8),
+    expandBits(9),
+    expandBits(10),
+    expandBits(11),
+    expandBits(12),
+    expandBits(13),
+    expandBits(14),
+    expandBits(15),
+};
+
+template <Cmp C>
+__attribute__((target("avx2"))) void selectAvx2(
+    const int64_t* values, size_t count, int64_t value, bool invert, uint8_t* selection)
+{
+    const auto rhs = _mm256_set1_epi64x(value);
+    const int flip = invert ? 0xf : 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const auto lhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        const auto res = C == Cmp::Eq ? _mm256_cmpeq_epi64(lhs, rhs)
+            : C == Cmp::Gt            ? _mm256_cmpgt_epi64(lhs, rhs)
+                                      : _mm256_cmpgt_epi64(rhs, lhs);
+        const auto bits = _mm256_movemask_pd(_mm256_castsi256_pd(res)) ^ flip;
+        uint32_t sel;
+        std::memcpy(&sel, selection + i, sizeof(sel));
+        sel &= byteMasks[bits];
+        std::memcpy(selection + i, &sel, sizeof(sel));
+    }
+    selectScalar<C>(values, count, value, invert, selection, i);
+}
+
+template <Cmp C>
+__attribute__((target("sse4.2"))) void selectSse42(
+    const int64_t* values, size_t count, int64_t value, bool invert, uint8_t* selection)
+{
+    const auto rhs = _mm_set1_epi64x(value);
+    const int flip = invert ? 0xf : 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const auto lhs0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        const auto lhs1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i + 2));
+        const auto res0 = C == Cmp::Eq ? _mm_cmpeq_epi64(lhs0, rhs)
+            : C == Cmp::Gt             ? _mm_cmpgt_epi64(lhs0, rhs)
+                                       : _mm_cmpgt_epi64(rhs, lhs0);
+        const auto res1 = C == Cmp::Eq ? _mm_cmpeq_epi64(lhs1, rhs)
+            : C == Cmp::Gt             ? _mm_cmpgt_epi64(lhs1, rhs)
+                                       : _mm_cmpgt_epi64(rhs, lhs1);
+        const auto bits = (_mm_movemask_pd(_mm_castsi128_pd(res0))
+                              | _mm_movemask_pd(_mm_castsi128_pd(res1)) << 2)
+            ^ flip;
+        uint32_t sel;
+        std::memcpy(&sel, selection + i, sizeof(sel));
+        sel &= byteMasks[bits];
+        std::memcpy(selection + i, &sel, sizeof(sel));
+    }
+    selectScalar<C>(values, count, value, invert, selection, i);
+}
+#endif
+
+template <Cmp C>
+void selectI64(const int64_t* values, size_t count, int64_t value, bool invert, uint8_t* selection)
+{
+#ifdef JUTILS_X86
+    static const auto kernel = __builtin_cpu_supports("avx2") ? selectAvx2<C>
+        : __builtin_cpu_supports("sse4.2")                    ? selectSse42<C>
+                                                              : nullptr;
+    if (kernel) {
+        kernel(values, count, value, invert, selection);
+        return;
+    }
+#endif
+    selectScalar<C>(values, count, value, invert, selection);
+}
+}
+
+struct Filter::Parser {
+    using NodePtr = std::unique_ptr<Node>;
+
+    Filter& filter;
+    const std::vector<std::string>& tokens;
+    const std::vector<Column>& columns;
+    size_t pos = 0;
+
+    bool accept(std::string_view token)
+    {
+        if (pos < tokens.size() && tokens[pos] == token) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    const std::string& next(const char* what)
+    {
+        if (pos >= tokens.size()) {
+            invalidExpression(std::string("expected ") + what);
+        }
+        return tokens[pos++];
+    }
+
+    static NodePtr constant(bool value)
+    {
+        auto node = std::make_unique<Node>();
+        node->kind = Node::Kind::Const;
+        node->value = value;
+        return node;
+    }
+
+    static NodePtr makeNot(NodePtr operand)
+    {
+        using Kind = Node::Kind;
+        if (operand->kind == Kind::Const) {
+            operand->value = !operand->value;
+            return operand;
+        }
+        if (operand->kind == Kind::Not) {
+            return std::move(operand->lhs);
+        }
+        if (operand->kind == Kind::Condition) {
+            // Integer comparisons and string equality have an opposite that's just as fast
+            auto& op = operand->condition.op;
+            switch (op) {
+            case Op::I64Eq:
+                op = Op::I64Ne;
+                return operand;
+            case Op::I64Ne:
+                op = Op::I64Eq;
+                return operand;
+            case Op::I64Lt:
+                op = Op::I64Ge;
+                return operand;
+            case Op::I64Le:
+                op = Op::I64Gt;
+                return operand;
+            case Op::I64Gt:
+                op = Op::I64Le;
+                return operand;
+            case Op::I64Ge:
+                op = Op::I64Lt;
+                return operand;
+            case Op::StrEq:
+                op = Op::StrNe;
+                return operand;
+            case Op::StrNe:
+                op = Op::StrEq;
+                return operand;
+            default:
+                break;
+            }
+        }
+        auto node = std::make_unique<Node>();
+        node->kind = Kind::Not;
+        node->lhs = std::move(operand);
+        return node;
+    }
+
+    // `absorbing` is the value that decides the result on its own (false for and, true for or)
+    static NodePtr makeBinary(Node::Kind kind, bool absorbing, NodePtr lhs, NodePtr rhs)
+    {
+        using Kind = Node::Kind;
+        if (lhs->kind == Kind::Const) {
+            return lhs->value == absorbing ? std::move(lhs) : std::move(rhs);
+        }
+        if (rhs->kind == Kind::Const) {
+            return rhs->value == absorbing ? std::move(rhs) : std::move(lhs);
+        }
+        auto node = std::make_unique<Node>();
+        node->kind = kind;
+        node->lhs = std::move(lhs);
+        node->rhs = std::move(rhs);
+        return node;
+    }
+
+    // Returns whether there are integer conditions in the subtree
+    static bool markRowWise(Node& node)
+    {
+        switch (node.kind) {
+        case Node::Kind::Const:
+            return false;
+        case Node::Kind::Condition:
+            node.rowWise = node.condition.op > Op::I64Ge;
+            return !node.rowWise;
+        case Node::Kind::Not:
+            node.rowWise = !markRowWise(*node.lhs);
+            return !node.rowWise;
+        case Node::Kind::And:
+        case Node::Kind::Or: {
+            // Both sides need to be marked
+            const auto lhs = markRowWise(*node.lhs);
+            const auto rhs = markRowWise(*node.rhs);
+            node.rowWise = !lhs && !rhs;
+            return !node.rowWise;
+        }
+        }
+        return false;
+    }
+
+    NodePtr parseOr()
+    {
+        auto lhs = parseAnd();
+        while (accept("or")) {
+            lhs = makeBinary(Node::Kind::Or, true, std::move(lhs), parseAnd());
+        }
+        return lhs;
+    }
+
+    NodePtr parseAnd()
+    {
+        auto lhs = parseNot();
+        while (accept("and")) {
+            lhs = makeBinary(Node::Kind::And, false, std::move(lhs), parseNot());
+        }
+        return lhs;
+    }
+
+    NodePtr parseNot()
+    {
+        if (accept("not")) {
+            return makeNot(parseNot());
+        }
+        if (accept("(")) {
+            auto node = parseOr();
+            if (!accept(")")) {
+                invalidExpression("expected ')'");
+            }
+            return node;
+        }
+        return parseCondition();
+    }
+
+    NodePtr parseCondition()
+    {
+        const auto& lhs = next("column name");
+        const auto& op = next("operator");
+        const auto& rhs = next("value");
+
+        const auto idx = getColumnIndex(columns, lhs);
+        if (!idx) {
+            std::cerr << "Invalid column name: " << lhs << std::endl;
+            std::exit(3);
+        }
+
+        auto node = std::make_unique<Node>();
+        node->kind = Node::Kind::Condition;
+        auto& cond = node->condition;
+        cond.column = static_cast<uint32_t>(*idx);
+        filter.usedColumns_[*idx] = true;
+
+        if (columns[*idx].type == Column::Type::I64) {
+            const auto value = parseInt(rhs);
+            if (op == "==" || op == "!=") {
+                // Only values that are printed exactly like rhs are equal to it
+                if (!value || std::to_string(*value) != rhs) {
+                    return constant(op == "!=");
+                }
+                cond.op = op == "==" ? Op::I64Eq : Op::I64Ne;
+            } else if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+                if (!value) {
+                    invalidExpression("'" + rhs + "' is not an integer");
+                }
+                cond.op = op == "<" ? Op::I64Lt
+                    : op == "<="    ? Op::I64Le
+                    : op == ">"     ? Op::I64Gt
+                                    : Op::I64Ge;
+            } else if (op == "contains" || op == "contains-any" || op == "contains-all"
+                || op == "startswith" || op == "endswith" || op == "=~") {
+                std::cerr << "Column type needs to be string for " << op << " operator"
+                          << std::endl;
+                std::exit(4);
+            } else {
+                std::cerr << "Invalid operation: " << op << std::endl;
+                std::exit(4);
+            }
+            cond.value = *value;
+            return node;
+        }
+
+        if (op == "==") {
+            cond.op = Op::StrEq;
+        } else if (op == "!=") {
+            cond.op = Op::StrNe;
+        } else if (op == "contains") {
+            cond.op = Op::Contains;
+        } else if (op == "contains-any") {
+            cond.op = Op::ContainsAny;
+        } else if (op == "contains-all") {
+            cond.op = Op::ContainsAll;
+        } else if (op == "startswith") {
+            cond.op = Op::StartsWith;
+        } else if (op == "endswith") {
+            cond.op = Op::EndsWith;
+        } else if (op == "=~") {
+            cond.op = Op::RegexSearch;
+        } else if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+            std::cerr << "Column type needs to be integer for " << op << " operator" << std::endl;
+            std::exit(4);
+        } else {
+            std::cerr << "Invalid operation: " << op << std::endl;
+            std::exit(4);
+        }
+
+        switch (cond.op) {
+        case Op::Contains:
+        case Op::ContainsAny:
+        case Op::ContainsAll: {
+            const auto needles
+                = cond.op == Op::Contains ? std::vector<std::string> { rhs } : splitList(rhs);
+            if (needles.size() == 1) {
+                cond.op = Op::Contains;
+                cond.index = static_cast<uint32_t>(filter.searches_.size());
+                filter.searches_.emplace_back(needles[0]);
+            } else {
+                cond.index = static_cast<uint32_t>(filter.multiSearches_.size());
+                filter.multiSearches_.emplace_back(needles);
+            }
+            break;
+        }
+        case Op::RegexSearch:
+            cond.index = static_cast<uint32_t>(filter.regexes_.size());
+            filter.regexes_.emplace_back(rhs);
+            break;
+        default:
+            cond.index = static_cast<uint32_t>(filter.strings_.size());
+            filter.strings_.push_back(rhs);
+            break;
+        }
+        cond.cache = static_cast<uint32_t>(filter.caches_.size());
+        filter.caches_.emplace_back();
+        return node;
+    }
+};
+
+Filter::Filter(const std::vector<std::string>& tokens, const std::vector<Column>& columns)
+    : columns_(columns)
+    , fields_(columns.size())
+    , usedColumns_(columns.size(), false)
+    , known_(columns.size(), false)
+{
+    if (tokens.empty()) {
+        root_ = Parser::constant(true);
+        program_.push_back(Instruction { Op::Const, 0, 0, 0, 1 });
+        return;
+    }
+    Parser parser { *this, tokens, columns };
+    root_ = parser.parseOr();
+    if (parser.pos < tokens.size()) {
+        invalidExpression("unexpected '" + tokens[parser.pos] + "'");
+    }
+    emit(*root_);
+    Parser::markRowWise(*root_);
+}
+
+Filter::Filter(const std::string& expression, const std::vector<Column>& columns)
+    : Filter(tokenize(expression), columns)
+{
+}
+
+Filter::~Filter() = default;
+
+void Filter::emit(Node& node)
+{
+    node.begin = static_cast<uint32_t>(program_.size());
+    switch (node.kind) {
+    case Node::Kind::Const:
+        program_.push_back(Instruction { Op::Const, 0, 0, 0, node.value });
+        break;
+    case Node::Kind::Condition:
+        program_.push_back(node.condition);
+        break;
+    case Node::Kind::Not:
+        emit(*node.lhs);
+        program_.push_back(Instruction { Op::Not });
+        break;
+    case Node::Kind::And:
+    case Node::Kind::Or: {
+        emit(*node.lhs);
+        const auto jump = program_.size();
+        program_.push_back(
+            Instruction { node.kind == Node::Kind::And ? Op::JumpIfFalse : Op::JumpIfTrue });
+        emit(*node.rhs);
+        program_[jump].index = static_cast<uint32_t>(program_.size());
+        break;
+    }
+    }
+    node.end = static_cast<uint32_t>(program_.size());
+}
+
+bool Filter::testString(const Instruction& ins, std::string_view str)
+{
+    switch (ins.op) {
+    case Op::StrEq:
+        return str == strings_[ins.index];
+    case Op::StrNe:
+        return str != strings_[ins.index];
+    case Op::Contains:
+        return searches_[ins.index].in(str);
+    case Op::ContainsAny:
+        return multiSearches_[ins.index].any(str);
+    case Op::ContainsAll:
+        return multiSearches_[ins.index].all(str);
+    case Op::StartsWith:
+        return str.substr(0, strings_[ins.index].size()) == strings_[ins.index];
+    case Op::EndsWith: {
+        const auto& suffix = strings_[ins.index];
+        return str.size() >= suffix.size() && str.substr(str.size() - suffix.size()) == suffix;
+    }
+    case Op::RegexSearch:
+        return regexes_[ins.index].search(str);
+    default:
+        std::abort();
+    }
+}
+
+bool Filter::testString(
+    const Instruction& ins, std::string_view str, uint64_t dictionary, uint32_t code)
+{
+    // String conditions are only tested once per distinct string of a dictionary
+    if (const auto cached = caches_[ins.cache].find(dictionary, code)) {
+        if (!*cached) {
+            *cached = testString(ins, str);
+        }
+        return **cached;
+    }
+    return testString(ins, str);
+}
+
+bool Filter::eval(const RowView& row)
+{
+    return run(row, 0, program_.size());
+}
+
+bool Filter::run(const RowView& row, size_t begin, size_t end)
+{
+    bool result = true;
+    size_t pc = begin;
+    while (pc < end) {
+        const auto& ins = program_[pc++];
+        switch (ins.op) {
+        case Op::Const:
+            result = ins.value != 0;
+            break;
+        case Op::I64Eq:
+            result = row.i64(ins.column) == ins.value;
+            break;
+        case Op::I64Ne:
+            result = row.i64(ins.column) != ins.value;
+            break;
+        case Op::I64Lt:
+            result = row.i64(ins.column) < ins.value;
+            break;
+        case Op::I64Le:
+            result = row.i64(ins.column) <= ins.value;
+            break;
+        case Op::I64Gt:
+            result = row.i64(ins.column) > ins.value;
+            break;
+        case Op::I64Ge:
+            result = row.i64(ins.column) >= ins.value;
+            break;
+        case Op::Not:
+            result = !result;
+            break;
+        case Op::JumpIfFalse:
+            if (!result) {
+                pc = ins.index;
+            }
+            break;
+        case Op::JumpIfTrue:
+            if (result) {
+                pc = ins.index;
+            }
+            break;
+        default:
+            result = testString(
+                ins, row.str(ins.column), row.dictionary(ins.column), row.code(ins.column));
+            break;
+        }
+    }
+    return result;
+}
+
+bool Filter::rejects(const std::vector<Value>& values, const std::vector<bool>& known)
+{
+    if (root_->kind == Node::Kind::Const) {
+        return !root_->value;
+    }
+    for (size_t i = 0; i < columns_.size(); ++i) {
+        known_[i] = known.empty() ? i < values.size() : known[i];
+        if (known_[i] && usedColumns_[i]) {
+            fields_[i] = FieldView {};
+            if (const auto i64 = std::get_if<int64_t>(&values[i])) {
+                fields_[i].i64 = *i64;
+            } else {
+                fields_[i].str = std::get<std::string>(values[i]);
+            }
+        }
+    }
+    const auto result = evalKnown(*root_, RowView(columns_, fields_.data()));
+    return result && !*result;
+}
+
+std::optional<bool> Filter::evalKnown(const Node& node, const RowView& row)
+{
+    switch (node.kind) {
+    case Node::Kind::Const:
+        return node.value;
+    case Node::Kind::Condition:
+        if (!known_[node.condition.column]) {
+            return std::nullopt;
+        }
+        return run(row, node.begin, node.end);
+    case Node::Kind::Not: {
+        const auto operand = evalKnown(*node.lhs, row);
+        return operand ? std::optional<bool>(!*operand) : std::nullopt;
+    }
+    case Node::Kind::And:
+    case Node::Kind::Or: {
+        // One side with the absorbing value decides the result, even if the other is unknown
+        const auto absorbing = node.kind == Node::Kind::Or;
+        const auto lhs = evalKnown(*node.lhs, row);
+        if (lhs == absorbing) {
+            return absorbing;
+        }
+        const auto rhs = evalKnown(*node.rhs, row);
+        if (rhs == absorbing) {
+            return absorbing;
+        }
+        return lhs && rhs ? std::optional<bool>(!absorbing) : std::nullopt;
+    }
+    }
+    return std::nullopt;
+}
+
+void Filter::evalBatch(const Block& block, std::vector<uint8_t>& selection)
+{
+    assert(selection.size() == block.size());
+    evalBatch(*root_, block, selection.data());
+}
+
+void Filter::evalBatch(const Node& node, const Block& block, uint8_t* selection)
+{
+    const auto size = block.size();
+    if (node.rowWise) {
+        for (size_t i = 0; i < size; ++i) {
+            if (selection[i]) {
+                selection[i] = run(block.row(i, fields_.data()), node.begin, node.end);
+            }
+        }
+        return;
+    }
+    switch (node.kind) {
+    case Node::Kind::Const:
+        if (!node.value) {
+            std::memset(selection, 0, size);
+        }
+        break;
+    case Node::Kind::Condition: {
+        const auto& ins = node.condition;
+        const auto values = block.i64s(ins.column);
+        switch (ins.op) {
+        case Op::I64Eq:
+            selectI64<Cmp::Eq>(values, size, ins.value, false, selection);
+            break;
+        case Op::I64Ne:
+            selectI64<Cmp::Eq>(values, size, ins.value, true, selection);
+            break;
+        case Op::I64Lt:
+            selectI64<Cmp::Lt>(values, size, ins.value, false, selection);
+            break;
+        case Op::I64Le:
+            selectI64<Cmp::Gt>(values, size, ins.value, true, selection);
+            break;
+        case Op::I64Gt:
+            selectI64<Cmp::Gt>(values, size, ins.value, false, selection);
+            break;
+        case Op::I64Ge:
+            selectI64<Cmp::Lt>(values, size, ins.value, true, selection);
+            break;
+        default:
+            // String conditions are rowWise
+            std::abort();
+        }
+        break;
+    }
+    case Node::Kind::Not: {
+        std::vector<uint8_t> operand(selection, selection + size);
+        evalBatch(*node.lhs, block, operand.data());
+        for (size_t i = 0; i < size; ++i) {
+            selection[i] &= !operand[i];
+        }
+        break;
+    }
+    case Node::Kind::And:
+        evalBatch(*node.lhs, block, selection);
+        evalBatch(*node.rhs, block, selection);
+        break;
+    case Node::Kind::Or: {
+        // The right side only needs to be evaluated for the rows the left side rejected
+        std::vector<uint8_t> rest(selection, selection + size);
+        evalBatch(*node.lhs, block, selection);
+        for (size_t i = 0; i < size; ++i) {
+            rest[i] &= !selection[i];
+        }
+        evalBatch(*node.rhs, block, rest.data());
+        for (size_t i = 0; i < size; ++i) {
+            selection[i] |= rest[i];
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+#include "regex.hpp"
+#include "search.hpp"
+
+// A condition on the values of a row, e.g. `pid > 100 and ( user == root or not cmd contains sh )`.
+// Conditions are `<column> <op> <value>` with these operators:
+//   on integer columns: == != < <= > >=
+//   on string columns: == != contains startswith endswith =~ (regex search)
+//     contains-any contains-all (with a comma separated list of strings)
+// They can be combined with `and`, `or`, `not` and parentheses (which need to be separate
+// arguments). `and` binds stronger than `or`. An empty expression is true for every row.
+//
+// The expression is compiled into a flat program with the column indices resolved and the values
+// parsed once. Constant parts (like comparing an integer column to a string that is not an
+// integer) are folded and `and`/`or` short-circuit.
+// Whole blocks can be evaluated at once, which compares integer columns with SIMD instructions.
+class Filter {
+public:
+    // Exits with an error message if the expression is invalid
+    Filter(const std::vector<std::string>& tokens, const std::vector<Column>& columns);
+    // The expression is split at whitespace, unless it's in quotes ('...' or "...")
+    Filter(const std::string& expression, const std::vector<Column>& columns);
+    ~Filter();
+
+    bool eval(const RowView& row);
+
+    // For producers that compute a row column by column (e.g. `jps --where`), so they can skip the
+    // rest of a row early: Whether the row can't match, whatever the columns that are not `known`
+    // hold. If `known` is empty, the first values.size() columns are known.
+    bool rejects(const std::vector<Value>& values, const std::vector<bool>& known = {});
+
+    // The columns the expression looks at
+    const std::vector<bool>& usedColumns() const { return usedColumns_; }
+
+    // `selection` holds a byte per row of `block`. The bytes of rows that don't match are set to
+    // 0. Rows that are 0 already are not evaluated.
+    void evalBatch(const Block& block, std::vector<uint8_t>& selection);
+
+private:
+    enum class Op : uint8_t {
+        Const,
+        I64Eq,
+        I64Ne,
+        I64Lt,
+        I64Le,
+        I64Gt,
+        I64Ge,
+        StrEq,
+        StrNe,
+        Contains,
+        ContainsAny,
+        ContainsAll,
+        StartsWith,
+        EndsWith,
+        RegexSearch,
+        Not,
+        // Continue at `index` if the result so far is false/true
+        JumpIfFalse,
+        JumpIfTrue,
+    };
+
+    struct Instruction {
+        Op op;
+        uint32_t column = 0;
+        // Jump target or index into strings_ (searches_ for Contains, multiSearches_ for
+        // ContainsAny/ContainsAll, regexes_ for RegexSearch)
+        uint32_t index = 0;
+        // Index into caches_ for string conditions
+        uint32_t cache = 0;
+        int64_t value = 0;
+    };
+
+    struct Node;
+    struct Parser;
+
+    void emit(Node& node);
+    // Runs program_[begin, end), which is the code of a subtree
+    bool run(const RowView& row, size_t begin, size_t end);
+    // The result of the subtree, if the known_ columns decide it
+    std::optional<bool> evalKnown(const Node& node, const RowView& row);
+    void evalBatch(const Node& node, const Block& block, uint8_t* selection);
+    bool testString(const Instruction& ins, std::string_view str);
+    bool testString(
+        const Instruction& ins, std::string_view str, uint64_t dictionary, uint32_t code);
+
+    std::unique_ptr<Node> root_;
+    std::vector<Instruction> program_;
+    std::vector<std::string> strings_;
+    std::vector<SubstringSearch> searches_;
+    std::vector<MultiSubstringSearch> multiSearches_;
+    std::vector<Regex> regexes_;
+    // Results of string conditions on dictionary encoded columns, per instruction
+    std::vector<DictionaryCache<bool>> caches_;
+    std::vector<Column> columns_;
+    std::vector<FieldView> fields_;
+    std::vector<bool> usedColumns_;
+    std::vector<bool> known_;
+};
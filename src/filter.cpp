@@ -1,114 +1,49 @@
+#include <algorithm>
 #include <iostream>
-#include <regex>
-#include <unordered_set>
+#include <limits>
 
 #include <clipp/clipp.hpp>
 
+#include "expr.hpp"
 #include "io.hpp"
+#include "keyset.hpp"
 #include "util.hpp"
 
 namespace {
 struct FilterArgs : clipp::ArgsBase {
     std::optional<std::string> unique; // TODO: Later allow expressions for this?
     bool invert = false;
+    std::optional<std::string> memoryLimit;
+    std::optional<double> falsePositiveRate = 0.01;
 
     void args()
     {
         flag(invert, "invert-match", 'v');
-        flag(unique, "unique", 'u');
+        flag(unique, "unique", 'u')
+            .help("Only output the first row of every value of these columns (comma separated).");
+        flag(memoryLimit, "memory-limit", 'm')
+            .help("Remember the values of --unique exactly until that takes this much memory (e.g. "
+                  "512M), then in a Bloom filter of this size, which drops some rows with new "
+                  "values.");
+        flag(falsePositiveRate, "false-positive-rate", 'f')
+            .help("How many of the rows with new values the Bloom filter of --memory-limit may "
+                  "drop (as long as it's not full).");
     }
-};
-
-struct Expr {
-    virtual bool eval(const std::vector<Value>& row) const = 0;
-    virtual ~Expr() = default;
-};
-
-struct TrueExpr : public Expr {
-    bool eval(const std::vector<Value>&) const override { return true; }
-};
-
-struct ContainsExpr : public Expr {
-    size_t column;
-    std::string needle;
-
-    ContainsExpr(size_t column, std::string needle)
-        : column(column)
-        , needle(needle)
-    {
-    }
-
-    bool eval(const std::vector<Value>& row) const override
-    {
-        return std::get<std::string>(row[column]).find(needle) != std::string::npos;
-    }
-};
-
-struct EqExpr : public Expr {
-    size_t column;
-    std::string rhs;
 
-    EqExpr(size_t column, std::string rhs)
-        : column(column)
-        , rhs(rhs)
+    std::string description() const override
     {
+        return R"(
+jfilter user == root
+jfilter pid '>' 100 and not cmdline contains bash
+jfilter '(' user == root or user == www ')' and state != S
+jfilter name startswith lib and name endswith .so
+jfilter cmdline contains-any java,python,node
+jfilter cmdline =~ '^/usr/s?bin/'
+jfilter -u user,state
+jfilter -u srcaddr,dstaddr -m 256M -f 0.001
+)";
     }
-
-    bool eval(const std::vector<Value>& row) const override { return toString(row[column]) == rhs; }
 };
-
-struct RegexMatchExpr : public Expr {
-    size_t column;
-    std::string pattern;
-    std::regex regex;
-
-    RegexMatchExpr(size_t column, std::string pattern)
-        : column(column)
-        , pattern(pattern)
-        , regex(pattern)
-    {
-    }
-
-    bool eval(const std::vector<Value>& row) const override
-    {
-        std::smatch m;
-        return std::regex_search(std::get<std::string>(row[column]), m, regex);
-    }
-};
-
-std::unique_ptr<Expr> parseExpr(
-    const std::vector<std::string>& where, const std::vector<Column>& columns)
-{
-    assert(where.size() == 3);
-    const auto& lhs = where[0];
-    const auto& op = where[1];
-    const auto& rhs = where[2];
-
-    const auto idx = getColumnIndex(columns, lhs);
-    if (!idx) {
-        std::cerr << "Invalid column name: " << lhs << std::endl;
-        std::exit(3);
-    }
-
-    if (op == "contains") {
-        if (columns[*idx].type != Column::Type::String) {
-            std::cerr << "Column type needs to be string for contains operator" << std::endl;
-            std::exit(4);
-        }
-        return std::make_unique<ContainsExpr>(*idx, rhs);
-    } else if (op == "==") {
-        return std::make_unique<EqExpr>(*idx, rhs);
-    } else if (op == "=~") {
-        if (columns[*idx].type != Column::Type::String) {
-            std::cerr << "Column type needs to be string for regex operator" << std::endl;
-            std::exit(4);
-        }
-        return std::make_unique<RegexMatchExpr>(*idx, rhs);
-    } else {
-        std::cerr << "Invalid operation: " << op << std::endl;
-        std::exit(4);
-    }
-}
 }
 
 int filter(int argc, char** argv)
@@ -119,32 +54,103 @@ int filter(int argc, char** argv)
 
     Input input;
 
-    const auto& exprTokens = args.remaining();
-    auto expr = !exprTokens.empty() ? parseExpr(exprTokens, input.columns())
-                                    : std::make_unique<TrueExpr>();
+    Filter expr(args.remaining(), input.columns());
+    // The other columns are only needed for the rows that are written
+    auto neededColumns = expr.usedColumns();
 
-    Output output(input.columns());
+    Output output(input.columns(), input.sortedBy());
+    output.passthrough(input);
+
+    // Rows of blocks are evaluated all at once, when the first row of a block comes along
+    std::vector<uint8_t> selection;
+    auto matches = [&](const RowView& row) {
+        const auto block = row.block();
+        if (!block) {
+            return expr.eval(row);
+        }
+        if (row.blockIndex() == 0) {
+            selection.assign(block->size(), 1);
+            expr.evalBatch(*block, selection);
+        }
+        return selection[row.blockIndex()] != 0;
+    };
 
     if (args.unique) {
-        const auto idxOpt = getColumnIndex(input.columns(), *args.unique);
-        if (!idxOpt) {
-            std::cerr << "Invalid column: " << *args.unique << std::endl;
+        std::vector<size_t> keyColumns;
+        size_t start = 0;
+        while (start <= args.unique->size()) {
+            const auto end = std::min(args.unique->find(',', start), args.unique->size());
+            const auto name = args.unique->substr(start, end - start);
+            const auto idx = getColumnIndex(input.columns(), name);
+            if (!idx) {
+                std::cerr << "Invalid column: " << name << std::endl;
+                return 1;
+            }
+            keyColumns.push_back(*idx);
+            neededColumns[*idx] = true;
+            start = end + 1;
+        }
+        input.needColumns(neededColumns);
+
+        auto memoryLimit = std::numeric_limits<size_t>::max();
+        if (args.memoryLimit) {
+            const auto limit = parseSize(*args.memoryLimit);
+            if (!limit || *limit == 0) {
+                std::cerr << "Invalid memory limit: " << *args.memoryLimit << std::endl;
+                return 1;
+            }
+            memoryLimit = *limit;
+        }
+        if (!(*args.falsePositiveRate > 0.0 && *args.falsePositiveRate < 1.0)) {
+            std::cerr << "Invalid false positive rate: " << *args.falsePositiveRate << std::endl;
             return 1;
         }
-        const auto idx = idxOpt.value();
+
         // TODO: Somehow build the uniqueness check into expr
-        std::unordered_set<Value> seen;
-        while (const auto row = input.row()) {
-            const auto res = seen.insert(row.value()[idx]);
-            if (res.second && expr->eval(*row)) {
-                output.row(row.value());
+        // Only the 64-bit hashes of the values are kept, so distinct values are taken for
+        // duplicates if their hashes collide. That's unlikely until there are billions of them.
+        KeySet seen(memoryLimit, *args.falsePositiveRate);
+        // Hashes of the strings of the current dictionaries, per key column
+        std::vector<DictionaryCache<uint64_t>> hashes(keyColumns.size());
+        const auto& columns = input.columns();
+        auto key = [&](const RowView& row) {
+            uint64_t key = 0;
+            for (size_t i = 0; i < keyColumns.size(); ++i) {
+                const auto idx = keyColumns[i];
+                uint64_t hash = 0;
+                if (columns[idx].type == Column::Type::I64) {
+                    hash = hashInt(row.i64(idx));
+                } else if (const auto cached = hashes[i].find(row, idx)) {
+                    if (!*cached) {
+                        *cached = hashBytes(row.str(idx));
+                    }
+                    hash = **cached;
+                } else {
+                    hash = hashBytes(row.str(idx));
+                }
+                key = hashCombine(key, hash);
+            }
+            return key;
+        };
+
+        while (const auto row = input.rowView()) {
+            const auto res = matches(*row);
+            if (seen.insert(key(*row)) && res) {
+                output.row(*row);
             }
         }
     } else {
-        while (const auto row = input.row()) {
-            const auto res = expr->eval(*row);
-            if ((!args.invert && res) || (args.invert && !res)) {
-                output.row(row.value());
+        input.needColumns(neededColumns);
+        while (const auto row = input.rowView()) {
+            if (matches(*row) != args.invert) {
+                output.row(*row);
+            } else if (row->block()) {
+                // Rows that are rejected as well don't need to be looked at
+                auto next = row->blockIndex() + 1;
+                while (next < selection.size() && (selection[next] != 0) == args.invert) {
+                    next++;
+                }
+                input.skip(next - row->blockIndex() - 1);
             }
         }
     }
@@ -1,37 +1,797 @@
 #include "io.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <numeric>
+#include <unordered_map>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "lz.hpp"
 #include "util.hpp"
 
 constexpr size_t MagicLen = 4;
 constexpr char Magic[MagicLen + 1] = "\xe9SIO";
 
 constexpr char RowStart[MagicLen + 1] = "\xe9ROW";
+constexpr char BlockStart[MagicLen + 1] = "\xe9" "BLK";
 
 using StringLen = uint16_t;
 using ColumnCount = uint32_t;
 using ColumnType = uint8_t;
+using Version = uint8_t;
+using HeaderFlags = uint32_t;
+using BlockRowCount = uint32_t;
+using BlockSize = uint32_t;
+using StringOffset = uint32_t;
 
-Output::Output(std::vector<Column> columns)
+// Version 1 streams start with the column count after the magic, so a column count that can never
+// occur marks streams that specify their version explicitly (followed by Version and HeaderFlags).
+constexpr ColumnCount VersionMarker = 0xffffffff;
+constexpr Version LatestVersion = 2;
+
+// Blocks are compressed and their header contains the uncompressed size after the payload size
+constexpr HeaderFlags CompressedBlocks = 1 << 0;
+// The columns are followed by the sort order of the rows: a SortKeyCount and for every key its
+// ColumnIndex and a u8 that is 1 for descending order
+constexpr HeaderFlags Sorted = 1 << 1;
+constexpr HeaderFlags KnownHeaderFlags = CompressedBlocks | Sorted;
+
+using SortKeyCount = uint32_t;
+using ColumnIndex = uint32_t;
+
+enum class ColumnEncoding : uint8_t {
+    Plain = 0,
+    Dictionary = 1,
+    Varint = 2,
+    DeltaVarint = 3,
+};
+
+using DictionarySize = uint32_t;
+using DictionaryCode = uint16_t;
+
+constexpr size_t BlockHeaderSize = MagicLen + sizeof(BlockRowCount) + sizeof(BlockSize);
+constexpr size_t CompressedBlockHeaderSize = BlockHeaderSize + sizeof(BlockSize);
+// A block is written when either limit is reached
+constexpr size_t MaxBlockRows = 4096;
+constexpr size_t MaxBlockBytes = 1024 * 1024;
+
+namespace {
+[[noreturn]] void invalidInput(const char* what)
+{
+    std::cerr << "Invalid input: " << what << std::endl;
+    std::exit(1);
+}
+
+struct StringSink {
+    std::string& str;
+
+    void write(const void* data, size_t size) { str.append(static_cast<const char*>(data), size); }
+
+    template <typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(&value, sizeof(T));
+    }
+};
+
+// Version 1 can't store longer strings, which are possible in version 2
+StringLen version1StringLen(size_t size)
+{
+    if (size > std::numeric_limits<StringLen>::max()) {
+        std::cerr << "Error writing output: A string of " << size
+                  << " bytes is too long for version 1 (JUTILS_FORMAT=1)" << std::endl;
+        std::exit(1);
+    }
+    return static_cast<StringLen>(size);
+}
+
+template <typename Sink>
+void encodeRow(Sink& sink, const std::vector<Column>& columns, const RowView& row)
+{
+    if (!row.raw().empty()) {
+        sink.write(row.raw().data(), row.raw().size());
+        return;
+    }
+    sink.write(RowStart, MagicLen);
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].type == Column::Type::I64) {
+            const auto value = row.i64(i);
+            sink.write(&value, sizeof(value));
+        } else {
+            const auto str = row.str(i);
+            const auto len = version1StringLen(str.size());
+            sink.write(&len, sizeof(len));
+            sink.write(str.data(), str.size());
+        }
+    }
+}
+
+// Decodes the encoded row at `data` into `fields` and returns its size. If the returned size is
+// larger than `size`, the row is incomplete, `fields` are not valid and the returned size is the
+// number of bytes needed to continue decoding.
+size_t decodeRow(
+    const std::vector<Column>& columns, const char* data, size_t size, FieldView* fields)
+{
+    if (size < MagicLen) {
+        return MagicLen;
+    }
+    if (std::memcmp(RowStart, data, MagicLen) != 0) {
+        invalidInput("missing row marker");
+    }
+    size_t offset = MagicLen;
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].type == Column::Type::I64) {
+            if (offset + sizeof(int64_t) > size) {
+                return offset + sizeof(int64_t);
+            }
+            std::memcpy(&fields[i].i64, data + offset, sizeof(int64_t));
+            offset += sizeof(int64_t);
+        } else {
+            StringLen len = 0;
+            if (offset + sizeof(len) > size) {
+                return offset + sizeof(len);
+            }
+            std::memcpy(&len, data + offset, sizeof(len));
+            offset += sizeof(len);
+            if (offset + len > size) {
+                return offset + len;
+            }
+            fields[i].str = std::string_view(data + offset, len);
+            offset += len;
+        }
+    }
+    return offset;
+}
+}
+
+RowView::RowView(const Block& block, size_t index, const FieldView* fields, bool complete)
+    : columns_(&block.columns())
+    , fields_(fields)
+    , block_(&block)
+    , blockIndex_(index)
+    , complete_(complete)
+{
+}
+
+Value RowView::value(size_t idx) const
+{
+    if ((*columns_)[idx].type == Column::Type::I64) {
+        return i64(idx);
+    } else {
+        return std::string(str(idx));
+    }
+}
+
+std::vector<Value> RowView::values() const
+{
+    std::vector<Value> values;
+    values.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+        values.push_back(value(i));
+    }
+    return values;
+}
+
+Writer::Writer(int fd, size_t bufferSize)
+    : fd_(fd)
+    , buffer_(bufferSize)
+{
+}
+
+Writer::~Writer()
+{
+    flush();
+}
+
+size_t Writer::defaultBufferSize()
+{
+    static const size_t size = []() -> size_t {
+        constexpr size_t defaultSize = 256 * 1024;
+        const auto env = std::getenv("JUTILS_BUFFER_SIZE");
+        if (!env) {
+            return defaultSize;
+        }
+        const std::string_view str(env);
+        size_t size = 0;
+        const auto res = std::from_chars(str.data(), str.data() + str.size(), size);
+        if (res.ec != std::errc() || res.ptr != str.data() + str.size() || size == 0) {
+            std::cerr << "Invalid JUTILS_BUFFER_SIZE: " << str << std::endl;
+            return defaultSize;
+        }
+        return size;
+    }();
+    return size;
+}
+
+namespace {
+void writeAll(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        const auto res = ::write(fd, data, size);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EPIPE) {
+                // The reading end is gone (e.g. `jslice -n 10` is done), so there is nobody left
+                // to produce output for. This is not an error.
+                std::exit(0);
+            }
+            std::cerr << "Error writing output: " << std::strerror(errno) << std::endl;
+            std::exit(1);
+        }
+        data += res;
+        size -= res;
+    }
+}
+}
+
+void Writer::writeSlow(const void* data, size_t size)
+{
+    flush();
+    if (size >= buffer_.size()) {
+        writeAll(fd_, static_cast<const char*>(data), size);
+    } else {
+        std::memcpy(buffer_.data(), data, size);
+        size_ = size;
+    }
+}
+
+void Writer::flush()
+{
+    writeAll(fd_, buffer_.data(), size_);
+    size_ = 0;
+}
+
+void Writer::copyRest(Reader& reader)
+{
+    flush();
+    if (reader.available() > 0) {
+        writeAll(fd_, reader.data(), reader.available());
+        reader.consume(reader.available());
+    }
+    if (reader.mapped()) {
+        return;
+    }
+
+    struct stat in, out;
+    if (::fstat(reader.fd(), &in) == 0 && S_ISFIFO(in.st_mode) && ::fstat(fd_, &out) == 0
+        && S_ISFIFO(out.st_mode)) {
+        while (true) {
+            const auto res = ::splice(reader.fd(), nullptr, fd_, nullptr, 1 << 20, SPLICE_F_MOVE);
+            if (res == 0) {
+                return;
+            }
+            if (res < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EPIPE) {
+                    std::exit(0);
+                }
+                // Not supported here, so copy it ourselves
+                break;
+            }
+        }
+    }
+
+    while (reader.ensure(1)) {
+        writeAll(fd_, reader.data(), reader.available());
+        reader.consume(reader.available());
+    }
+}
+
+Block::Block(const std::vector<Column>& columns)
+    : columns_(&columns)
+{
+    clear();
+}
+
+size_t Block::byteSize() const
+{
+    size_t size = 0;
+    for (const auto& data : data_) {
+        size += data.i64s.size() * sizeof(int64_t) + data.offsets.size() * sizeof(StringOffset)
+            + data.bytes.size() + data.codes.size() * sizeof(DictionaryCode);
+    }
+    return size;
+}
+
+RowView Block::row(size_t row, FieldView* fields) const
+{
+    bool complete = true;
+    for (size_t i = 0; i < data_.size(); ++i) {
+        if (!data_[i].skipped.empty()) {
+            complete = false;
+            continue;
+        }
+        if ((*columns_)[i].type == Column::Type::I64) {
+            fields[i].i64 = i64(i, row);
+        } else {
+            fields[i].str = str(i, row);
+            fields[i].dictionary = data_[i].dictionary;
+            fields[i].code = data_[i].dictionary ? data_[i].codes[row] : 0;
+        }
+    }
+    return RowView(*this, row, fields, complete);
+}
+
+void Block::clear()
+{
+    encoded_ = {};
+    data_.resize(columns_->size());
+    for (size_t i = 0; i < data_.size(); ++i) {
+        auto& data = data_[i];
+        data.i64s.clear();
+        if ((*columns_)[i].type == Column::Type::String) {
+            data.offsets.assign(1, 0);
+        } else {
+            data.offsets.clear();
+        }
+        data.ownedBytes.clear();
+        data.bytes = data.ownedBytes;
+        data.dictionary = 0;
+        data.codes.clear();
+        data.encoded = {};
+        data.skipped = {};
+    }
+    size_ = 0;
+}
+
+void Block::pushStr(ColumnData& data, std::string_view str)
+{
+    data.ownedBytes.append(str);
+    data.offsets.push_back(data.ownedBytes.size());
+    data.bytes = data.ownedBytes;
+}
+
+void Block::push(const std::vector<Value>& values)
+{
+    assert(values.size() == data_.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (const auto valI64 = std::get_if<int64_t>(&values[i])) {
+            assert((*columns_)[i].type == Column::Type::I64);
+            data_[i].i64s.push_back(*valI64);
+        } else if (const auto valStr = std::get_if<std::string>(&values[i])) {
+            assert((*columns_)[i].type == Column::Type::String);
+            pushStr(data_[i], *valStr);
+        }
+    }
+    size_++;
+}
+
+void Block::push(const RowView& row)
+{
+    assert(row.size() == data_.size());
+    for (size_t i = 0; i < data_.size(); ++i) {
+        if ((*columns_)[i].type == Column::Type::I64) {
+            data_[i].i64s.push_back(row.i64(i));
+        } else {
+            pushStr(data_[i], row.str(i));
+        }
+    }
+    size_++;
+}
+
+namespace {
+struct DictionaryEncoding {
+    std::vector<std::string_view> entries;
+    std::vector<DictionaryCode> codes;
+    size_t numBytes = 0;
+
+    size_t encodedSize() const
+    {
+        return sizeof(DictionarySize) + (entries.size() + 1) * sizeof(StringOffset) + numBytes
+            + codes.size() * sizeof(DictionaryCode);
+    }
+};
+
+// Returns a dictionary encoding of the column, if it is smaller than the plain encoding
+std::optional<DictionaryEncoding> buildDictionary(const Block& block, size_t col)
+{
+    // With this many distinct values, it's not worth it
+    const auto maxEntries
+        = std::min<size_t>(block.size() / 2, std::numeric_limits<DictionaryCode>::max());
+    std::unordered_map<std::string_view, DictionaryCode> codes;
+    DictionaryEncoding dict;
+    dict.codes.reserve(block.size());
+    size_t plainSize = (block.size() + 1) * sizeof(StringOffset);
+    for (size_t row = 0; row < block.size(); ++row) {
+        const auto str = block.str(col, row);
+        plainSize += str.size();
+        auto it = codes.find(str);
+        if (it == codes.end()) {
+            if (codes.size() >= maxEntries) {
+                return std::nullopt;
+            }
+            it = codes.emplace(str, static_cast<DictionaryCode>(dict.entries.size())).first;
+            dict.entries.push_back(str);
+            dict.numBytes += str.size();
+        }
+        dict.codes.push_back(it->second);
+    }
+    if (dict.encodedSize() >= plainSize) {
+        return std::nullopt;
+    }
+    return dict;
+}
+
+uint64_t nextDictionaryId()
+{
+    static uint64_t id = 0;
+    return ++id;
+}
+
+uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+void appendVarint(std::string& str, uint64_t value)
+{
+    while (value >= 0x80) {
+        str.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    str.push_back(static_cast<char>(value));
+}
+
+bool readVarint(const char*& data, const char* end, uint64_t& value)
+{
+    value = 0;
+    for (size_t shift = 0; shift < 64 && data < end; shift += 7) {
+        const auto byte = static_cast<uint8_t>(*data++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the encoding and its payload, if a varint encoding is smaller than the plain encoding
+std::optional<std::pair<ColumnEncoding, std::string>> compactIntegers(
+    const std::vector<int64_t>& values)
+{
+    std::string varints;
+    std::string deltas;
+    uint64_t prev = 0;
+    for (const auto value : values) {
+        appendVarint(varints, zigzag(value));
+        // Wraps around instead of overflowing, which the decoder undoes
+        appendVarint(deltas, zigzag(static_cast<int64_t>(static_cast<uint64_t>(value) - prev)));
+        prev = static_cast<uint64_t>(value);
+    }
+    const auto plainSize = values.size() * sizeof(int64_t);
+    if (deltas.size() < varints.size() && deltas.size() < plainSize) {
+        return std::pair(ColumnEncoding::DeltaVarint, std::move(deltas));
+    } else if (varints.size() < plainSize) {
+        return std::pair(ColumnEncoding::Varint, std::move(varints));
+    }
+    return std::nullopt;
+}
+}
+
+void Block::encode(std::string& payload, bool compact) const
+{
+    std::vector<std::optional<DictionaryEncoding>> dicts(data_.size());
+    std::vector<std::optional<std::pair<ColumnEncoding, std::string>>> varints(data_.size());
+    size_t payloadSize = 0;
+    for (size_t i = 0; i < data_.size(); ++i) {
+        const auto& data = data_[i];
+        payloadSize += sizeof(ColumnEncoding);
+        if ((*columns_)[i].type == Column::Type::I64) {
+            if (compact && (varints[i] = compactIntegers(data.i64s))) {
+                payloadSize += varints[i]->second.size();
+            } else {
+                payloadSize += data.i64s.size() * sizeof(int64_t);
+            }
+        } else if ((dicts[i] = buildDictionary(*this, i))) {
+            payloadSize += dicts[i]->encodedSize();
+        } else {
+            payloadSize += data.offsets.size() * sizeof(StringOffset) + data.bytes.size();
+        }
+    }
+    assert(payloadSize <= std::numeric_limits<BlockSize>::max());
+
+    payload.reserve(payload.size() + payloadSize);
+    StringSink writer { payload };
+    for (size_t i = 0; i < data_.size(); ++i) {
+        const auto& data = data_[i];
+        if (const auto& encoded = varints[i]) {
+            writer.write(encoded->first);
+            writer.write(encoded->second.data(), encoded->second.size());
+        } else if ((*columns_)[i].type == Column::Type::I64) {
+            writer.write(ColumnEncoding::Plain);
+            writer.write(data.i64s.data(), data.i64s.size() * sizeof(int64_t));
+        } else if (const auto& dict = dicts[i]) {
+            writer.write(ColumnEncoding::Dictionary);
+            writer.write(static_cast<DictionarySize>(dict->entries.size()));
+            StringOffset offset = 0;
+            writer.write(offset);
+            for (const auto& entry : dict->entries) {
+                offset += entry.size();
+                writer.write(offset);
+            }
+            for (const auto& entry : dict->entries) {
+                writer.write(entry.data(), entry.size());
+            }
+            writer.write(dict->codes.data(), dict->codes.size() * sizeof(DictionaryCode));
+        } else {
+            writer.write(ColumnEncoding::Plain);
+            writer.write(data.offsets.data(), data.offsets.size() * sizeof(StringOffset));
+            writer.write(data.bytes.data(), data.bytes.size());
+        }
+    }
+}
+
+bool Block::decode(std::string_view payload, size_t numRows, const std::vector<bool>& needed)
+{
+    clear();
+    size_t offset = 0;
+    for (size_t i = 0; i < data_.size(); ++i) {
+        const auto start = offset;
+        if (needed.empty() || needed[i]) {
+            if (!decodeColumn(i, payload, offset, numRows)) {
+                return false;
+            }
+        } else {
+            if (!skipColumn(i, payload, offset, numRows)) {
+                return false;
+            }
+            data_[i].skipped = payload.substr(start, offset - start);
+        }
+        data_[i].encoded = payload.substr(start, offset - start);
+    }
+    size_ = numRows;
+    return offset == payload.size();
+}
+
+bool Block::decodeSkipped() const
+{
+    for (size_t i = 0; i < data_.size(); ++i) {
+        const auto skipped = data_[i].skipped;
+        if (skipped.empty()) {
+            continue;
+        }
+        size_t offset = 0;
+        if (!decodeColumn(i, skipped, offset, size_) || offset != skipped.size()) {
+            return false;
+        }
+        data_[i].skipped = {};
+    }
+    return true;
+}
+
+bool Block::skipColumn(size_t col, std::string_view payload, size_t& offset, size_t numRows) const
+{
+    // Only the sizes are read, nothing is validated or copied
+    auto skip = [&](size_t size) {
+        if (offset + size > payload.size()) {
+            return false;
+        }
+        offset += size;
+        return true;
+    };
+    auto skipStrings = [&](size_t num) {
+        StringOffset size = 0;
+        const auto lastOffset = offset + num * sizeof(StringOffset);
+        if (lastOffset + sizeof(size) > payload.size()) {
+            return false;
+        }
+        std::memcpy(&size, payload.data() + lastOffset, sizeof(size));
+        return skip((num + 1) * sizeof(StringOffset) + size);
+    };
+
+    if (offset + sizeof(ColumnEncoding) > payload.size()) {
+        return false;
+    }
+    const auto encoding = static_cast<ColumnEncoding>(payload[offset]);
+    offset += sizeof(ColumnEncoding);
+    if ((*columns_)[col].type == Column::Type::I64) {
+        if (encoding == ColumnEncoding::Plain) {
+            return skip(numRows * sizeof(int64_t));
+        } else if (encoding == ColumnEncoding::Varint
+            || encoding == ColumnEncoding::DeltaVarint) {
+            // Every varint ends with a byte that has the high bit cleared
+            size_t ends = 0;
+            while (ends < numRows && offset < payload.size()) {
+                ends += (payload[offset++] & 0x80) == 0;
+            }
+            return ends == numRows;
+        }
+        return false;
+    } else if (encoding == ColumnEncoding::Plain) {
+        return skipStrings(numRows);
+    } else if (encoding == ColumnEncoding::Dictionary) {
+        DictionarySize numEntries = 0;
+        if (offset + sizeof(numEntries) > payload.size()) {
+            return false;
+        }
+        std::memcpy(&numEntries, payload.data() + offset, sizeof(numEntries));
+        offset += sizeof(numEntries);
+        return skipStrings(numEntries) && skip(numRows * sizeof(DictionaryCode));
+    }
+    return false;
+}
+
+bool Block::decodeColumn(
+    size_t col, std::string_view payload, size_t& offset, size_t numRows) const
+{
+    auto take = [&](size_t size) -> const char* {
+        if (offset + size > payload.size()) {
+            return nullptr;
+        }
+        const auto ptr = payload.data() + offset;
+        offset += size;
+        return ptr;
+    };
+
+    // Reads `num` strings (offsets and bytes)
+    auto takeStrings = [&](ColumnData& data, size_t num) {
+        const auto offsets = take((num + 1) * sizeof(StringOffset));
+        if (!offsets) {
+            return false;
+        }
+        data.offsets.resize(num + 1);
+        std::memcpy(data.offsets.data(), offsets, (num + 1) * sizeof(StringOffset));
+        for (size_t r = 0; r < num; ++r) {
+            if (data.offsets[r] > data.offsets[r + 1]) {
+                return false;
+            }
+        }
+        const auto bytes = take(data.offsets[num]);
+        if (data.offsets[0] != 0 || !bytes) {
+            return false;
+        }
+        data.bytes = std::string_view(bytes, data.offsets[num]);
+        return true;
+    };
+
+    auto& data = data_[col];
+    const auto encodingPtr = take(sizeof(ColumnEncoding));
+    if (!encodingPtr) {
+        return false;
+    }
+    const auto encoding = static_cast<ColumnEncoding>(*encodingPtr);
+    if ((*columns_)[col].type == Column::Type::I64) {
+        if (encoding == ColumnEncoding::Plain) {
+            // The row count is only trusted after the payload turned out to be large enough
+            const auto i64s = take(numRows * sizeof(int64_t));
+            if (!i64s) {
+                return false;
+            }
+            data.i64s.resize(numRows);
+            std::memcpy(data.i64s.data(), i64s, numRows * sizeof(int64_t));
+        } else if (encoding == ColumnEncoding::Varint || encoding == ColumnEncoding::DeltaVarint) {
+            const auto delta = encoding == ColumnEncoding::DeltaVarint;
+            const char* ptr = payload.data() + offset;
+            const char* end = payload.data() + payload.size();
+            // Every varint takes at least one byte
+            if (numRows > static_cast<size_t>(end - ptr)) {
+                return false;
+            }
+            data.i64s.resize(numRows);
+            uint64_t prev = 0;
+            for (size_t r = 0; r < numRows; ++r) {
+                uint64_t value = 0;
+                if (!readVarint(ptr, end, value)) {
+                    return false;
+                }
+                const auto decoded = unzigzag(value);
+                prev = delta ? prev + static_cast<uint64_t>(decoded)
+                             : static_cast<uint64_t>(decoded);
+                data.i64s[r] = static_cast<int64_t>(prev);
+            }
+            offset = ptr - payload.data();
+        } else {
+            return false;
+        }
+    } else if (encoding == ColumnEncoding::Plain) {
+        if (!takeStrings(data, numRows)) {
+            return false;
+        }
+    } else if (encoding == ColumnEncoding::Dictionary) {
+        DictionarySize numEntries = 0;
+        const auto numEntriesPtr = take(sizeof(numEntries));
+        if (!numEntriesPtr) {
+            return false;
+        }
+        std::memcpy(&numEntries, numEntriesPtr, sizeof(numEntries));
+        if (!takeStrings(data, numEntries)) {
+            return false;
+        }
+        const auto codes = take(numRows * sizeof(DictionaryCode));
+        if (!codes) {
+            return false;
+        }
+        data.codes.resize(numRows);
+        for (size_t r = 0; r < numRows; ++r) {
+            DictionaryCode code = 0;
+            std::memcpy(&code, codes + r * sizeof(DictionaryCode), sizeof(code));
+            if (code >= numEntries) {
+                return false;
+            }
+            data.codes[r] = code;
+        }
+        data.dictionary = nextDictionaryId();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+namespace {
+bool getEnvFlag(const char* name)
+{
+    const auto env = std::getenv(name);
+    return env && std::string_view(env) != "" && std::string_view(env) != "0";
+}
+
+int outputVersion()
+{
+    const auto env = std::getenv("JUTILS_FORMAT");
+    if (!env) {
+        return LatestVersion;
+    }
+    const std::string_view str(env);
+    if (str == "1" || str == "2") {
+        return str[0] - '0';
+    }
+    std::cerr << "Invalid JUTILS_FORMAT: " << str << std::endl;
+    std::exit(1);
+}
+}
+
+Output::Output(std::vector<Column> columns, std::vector<SortKey> sortedBy, int fd)
     : columns_(std::move(columns))
-    , textOutput_(::isatty(STDOUT_FILENO))
+    , writer_(fd)
+    , block_(columns_)
+    , version_(outputVersion())
+    , compactIntegers_(getEnvFlag("JUTILS_COMPACT_INTEGERS"))
+    , compress_(getEnvFlag("JUTILS_COMPRESS"))
+    , textOutput_(::isatty(fd))
 {
     if (!textOutput_) {
-        ::write(STDOUT_FILENO, Magic, MagicLen);
+        writer_.write(Magic, MagicLen);
+        if (version_ > 1) {
+            writer_.write(VersionMarker);
+            writer_.write(static_cast<Version>(version_));
+            const HeaderFlags flags
+                = (compress_ ? CompressedBlocks : 0) | (!sortedBy.empty() ? Sorted : 0);
+            writer_.write(flags);
+        }
         const ColumnCount columnCount = columns_.size(); // TODO: byte order
-        ::write(STDOUT_FILENO, &columnCount, sizeof(columnCount));
+        writer_.write(columnCount);
         for (const auto& col : columns_) {
-            const auto type = static_cast<ColumnType>(col.type);
-            ::write(STDOUT_FILENO, &type, sizeof(type));
-            const auto nameLen = static_cast<StringLen>(col.name.size());
-            ::write(STDOUT_FILENO, &nameLen, sizeof(nameLen));
-            ::write(STDOUT_FILENO, col.name.data(), col.name.size());
+            writer_.write(static_cast<ColumnType>(col.type));
+            writer_.write(static_cast<StringLen>(col.name.size()));
+            writer_.write(col.name.data(), col.name.size());
+        }
+        // Version 1 has no place for the sort order, so it's lost
+        if (version_ > 1 && !sortedBy.empty()) {
+            writer_.write(static_cast<SortKeyCount>(sortedBy.size()));
+            for (const auto& key : sortedBy) {
+                assert(key.column < columns_.size());
+                writer_.write(static_cast<ColumnIndex>(key.column));
+                writer_.write(static_cast<uint8_t>(key.descending));
+            }
         }
     }
 }
@@ -43,42 +803,251 @@ Output::~Output()
 
 void Output::row(const std::vector<Value>& values)
 {
-    if (!textOutput_) {
-        ::write(STDOUT_FILENO, RowStart, MagicLen);
+    assert(values.size() == columns_.size());
+    if (textOutput_) {
+        std::vector<std::string> cells;
+        cells.reserve(values.size());
+        for (const auto& value : values) {
+            cells.push_back(toString(value));
+        }
+        textRow(std::move(cells));
+    } else if (version_ > 1) {
+        block_.push(values);
+        if (block_.size() >= MaxBlockRows || block_.byteSize() >= MaxBlockBytes) {
+            flushBlock();
+        }
+    } else {
+        writer_.write(RowStart, MagicLen);
         for (size_t i = 0; i < values.size(); ++i) {
             if (const auto valI64 = std::get_if<int64_t>(&values[i])) {
                 assert(columns_[i].type == Column::Type::I64);
-                ::write(STDOUT_FILENO, valI64, sizeof(std::remove_pointer_t<decltype(valI64)>));
+                writer_.write(*valI64);
             } else if (const auto valStr = std::get_if<std::string>(&values[i])) {
                 assert(columns_[i].type == Column::Type::String);
-                const auto len = static_cast<StringLen>(valStr->size());
-                ::write(STDOUT_FILENO, &len, sizeof(len));
-                ::write(STDOUT_FILENO, valStr->data(), valStr->size());
+                writer_.write(version1StringLen(valStr->size()));
+                writer_.write(valStr->data(), valStr->size());
             }
         }
-    } else {
-        rows_.push_back(values);
     }
 }
 
-namespace {
-std::vector<size_t> getColumnWidths(
-    const std::vector<Column>& columns, const std::vector<std::vector<Value>>& rows)
+void Output::row(const RowView& row)
 {
-    std::vector<size_t> colWidths;
-    colWidths.reserve(columns.size());
-    for (const auto& col : columns) {
-        colWidths.push_back(col.name.size() + 2);
+    assert(row.size() == columns_.size() && passthroughColumns_.empty());
+    if (passthrough_ && continueRun(row)) {
+        return;
     }
+    writeRow(completeRow(row));
+}
 
-    for (const auto& row : rows) {
+void Output::row(const RowView& row, const std::vector<size_t>& indices)
+{
+    assert(indices.size() == columns_.size());
+    assert(!passthrough_ || indices == passthroughColumns_);
+    if (passthrough_ && continueRun(row)) {
+        return;
+    }
+    writeRow(project(completeRow(row), indices));
+}
+
+void Output::writeRow(const RowView& row)
+{
+    if (textOutput_) {
+        std::vector<std::string> cells;
+        cells.reserve(row.size());
         for (size_t i = 0; i < row.size(); ++i) {
-            colWidths[i] = std::max(colWidths[i], toString(row[i]).size() + 2);
+            if (columns_[i].type == Column::Type::I64) {
+                cells.push_back(std::to_string(row.i64(i)));
+            } else {
+                cells.emplace_back(row.str(i));
+            }
+        }
+        textRow(std::move(cells));
+    } else if (version_ > 1) {
+        pushBlockRow(row);
+    } else {
+        encodeRow(writer_, columns_, row);
+    }
+}
+
+RowView Output::completeRow(const RowView& row)
+{
+    if (row.complete()) {
+        return row;
+    }
+    const auto block = row.block();
+    if (!block->decodeSkipped()) {
+        invalidInput("malformed block");
+    }
+    completeFields_.resize(row.size());
+    return block->row(row.blockIndex(), completeFields_.data());
+}
+
+RowView Output::project(const RowView& row, const std::vector<size_t>& indices)
+{
+    projectedFields_.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        projectedFields_[i] = row.field(indices[i]);
+    }
+    return RowView(columns_, projectedFields_.data());
+}
+
+// Returns false if the row is not part of a run, so it needs to be written by the caller
+bool Output::continueRun(const RowView& row)
+{
+    if (!row.block() || row.block()->encoded().empty()) {
+        return false;
+    }
+    if (row.block() != runBlock_ || row.blockIndex() != runRows_) {
+        flushRun();
+        if (row.blockIndex() != 0) {
+            return false;
+        }
+        runBlock_ = row.block();
+    }
+    // Don't touch the row until we know whether the whole block is passed
+    runRows_++;
+    if (runRows_ == runBlock_->size()) {
+        flushBlock();
+        if (passthroughColumns_.empty()) {
+            const auto encoded = runBlock_->encoded();
+            writer_.write(encoded.data(), encoded.size());
+        } else {
+            payload_.clear();
+            for (const auto idx : passthroughColumns_) {
+                payload_.append(runBlock_->encodedColumn(idx));
+            }
+            writeBlock(runBlock_->size());
+        }
+        runBlock_ = nullptr;
+        runRows_ = 0;
+    }
+    return true;
+}
+
+void Output::pushBlockRow(const RowView& row)
+{
+    block_.push(row);
+    if (block_.size() >= MaxBlockRows || block_.byteSize() >= MaxBlockBytes) {
+        flushBlock();
+    }
+}
+
+void Output::flushRun()
+{
+    if (!runBlock_) {
+        return;
+    }
+    if (!runBlock_->decodeSkipped()) {
+        invalidInput("malformed block");
+    }
+    for (size_t i = 0; i < runRows_; ++i) {
+        const auto row = runBlock_->row(i, runFields_.data());
+        pushBlockRow(passthroughColumns_.empty() ? row : project(row, passthroughColumns_));
+    }
+    runBlock_ = nullptr;
+    runRows_ = 0;
+}
+
+bool Output::canCopy(const Input& input) const
+{
+    if (textOutput_ || version_ != input.version_ || columns_.size() != input.columns_.size()) {
+        return false;
+    }
+    if (version_ > 1 && compress_ != input.compressed_) {
+        return false;
+    }
+    for (size_t i = 0; i < columns_.size(); ++i) {
+        if (columns_[i].type != input.columns_[i].type) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Output::passthrough(Input& input)
+{
+    watch(input);
+    // Version 1 rows are copied by row() already
+    if (version_ < 2 || !canCopy(input)) {
+        return;
+    }
+    passthrough_ = true;
+    runFields_.resize(columns_.size());
+    input.blockEnd_ = [this]() { flushRun(); };
+}
+
+void Output::passthrough(Input& input, std::vector<size_t> indices)
+{
+    watch(input);
+    // The columns are copied into a new block, so the input may be compressed differently
+    if (textOutput_ || version_ < 2 || input.version_ < 2) {
+        return;
+    }
+    assert(indices.size() == columns_.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        assert(columns_[i].type == input.columns_[indices[i]].type);
+    }
+    passthrough_ = true;
+    passthroughColumns_ = std::move(indices);
+    runFields_.resize(input.columns_.size());
+    input.blockEnd_ = [this]() { flushRun(); };
+    input.needColumns(std::vector<bool>(input.columns_.size(), false));
+}
+
+void Output::copyRest(Input& input)
+{
+    if (!canCopy(input)) {
+        while (const auto row = input.rowView()) {
+            this->row(*row);
         }
+        return;
+    }
+    // Finish the current block, the rest of the input is made of complete blocks
+    if (version_ > 1) {
+        while (input.blockRow_ < input.block_.size()) {
+            row(*input.rowView());
+        }
+        flushRun();
+        flushBlock();
+    }
+    writer_.copyRest(input.reader_);
+}
+
+void Output::flushBlock()
+{
+    if (block_.size() == 0) {
+        return;
+    }
+    payload_.clear();
+    block_.encode(payload_, compactIntegers_);
+    writeBlock(block_.size());
+    block_.clear();
+}
+
+// Writes payload_ as a block
+void Output::writeBlock(size_t numRows)
+{
+    writer_.write(BlockStart, MagicLen);
+    writer_.write(static_cast<BlockRowCount>(numRows));
+    if (compress_) {
+        compressed_.clear();
+        lzCompress(payload_, compressed_);
+        writer_.write(static_cast<BlockSize>(compressed_.size()));
+        writer_.write(static_cast<BlockSize>(payload_.size()));
+        writer_.write(compressed_.data(), compressed_.size());
+    } else {
+        writer_.write(static_cast<BlockSize>(payload_.size()));
+        writer_.write(payload_.data(), payload_.size());
     }
-    return colWidths;
 }
 
+namespace {
+// Column widths are determined from this many rows or the rows that arrive in this time, whichever
+// comes first. Later rows that don't fit widen the columns and print the header again.
+constexpr size_t TextSampleRows = 100;
+constexpr auto TextSampleTime = std::chrono::milliseconds(100);
+
 void printPadded(const std::string& str, size_t colWidth)
 {
     const auto padding = colWidth > str.size() ? colWidth - str.size() : 1;
@@ -86,97 +1055,473 @@ void printPadded(const std::string& str, size_t colWidth)
 }
 }
 
+void Output::textRow(std::vector<std::string> cells)
+{
+    if (colWidths_.empty()) {
+        if (sample_.empty()) {
+            sampleStart_ = std::chrono::steady_clock::now();
+        }
+        sample_.push_back(std::move(cells));
+        if (sample_.size() >= TextSampleRows
+            || std::chrono::steady_clock::now() - sampleStart_ >= TextSampleTime) {
+            flushSample();
+        }
+        return;
+    }
+
+    // The last column is not padded, so it never needs to grow
+    bool grow = false;
+    for (size_t i = 0; i < columns_.size() - 1; ++i) {
+        if (cells[i].size() + 2 > colWidths_[i]) {
+            // Leave some room, so the header is not repeated for every slightly longer value
+            colWidths_[i] = cells[i].size() + 2 + cells[i].size() / 4;
+            grow = true;
+        }
+    }
+    if (grow) {
+        std::cout << "\n";
+        printHeader();
+    }
+    printRow(cells);
+}
+
+void Output::watch(Input& input)
+{
+    if (!textOutput_) {
+        return;
+    }
+    input.reader_.setWaitHook([this, fd = input.reader_.fd()]() {
+        if (!colWidths_.empty() || sample_.empty()) {
+            return;
+        }
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(
+            TextSampleTime - (std::chrono::steady_clock::now() - sampleStart_));
+        if (left.count() > 0) {
+            ::pollfd pfd { fd, POLLIN, 0 };
+            if (::poll(&pfd, 1, static_cast<int>(left.count())) != 0) {
+                // More rows (or the end of the input) arrived in time
+                return;
+            }
+        }
+        flushSample();
+    });
+}
+
+void Output::flushSample()
+{
+    colWidths_.clear();
+    for (const auto& col : columns_) {
+        colWidths_.push_back(col.name.size() + 2);
+    }
+    for (const auto& row : sample_) {
+        for (size_t i = 0; i < row.size(); ++i) {
+            colWidths_[i] = std::max(colWidths_[i], row[i].size() + 2);
+        }
+    }
+
+    printHeader();
+    for (const auto& row : sample_) {
+        printRow(row);
+    }
+    sample_.clear();
+    sample_.shrink_to_fit();
+}
+
+void Output::printHeader()
+{
+    for (size_t i = 0; i < columns_.size() - 1; ++i) {
+        printPadded(columns_[i].name, colWidths_[i]);
+    }
+    // Print the last column without padding
+    std::cout << columns_[columns_.size() - 1].name;
+
+    const auto fullWidth = std::accumulate(colWidths_.begin(), colWidths_.end(), 0ul);
+    std::cout << "\n" << std::string(fullWidth, '-') << std::endl;
+}
+
+void Output::printRow(const std::vector<std::string>& cells)
+{
+    for (size_t i = 0; i < columns_.size() - 1; ++i) {
+        printPadded(cells[i], colWidths_[i]);
+    }
+    // stdout is line buffered when it is a terminal, so every row shows up right away
+    std::cout << cells[columns_.size() - 1] << "\n";
+}
+
 void Output::flush()
 {
-    if (textOutput_) {
-        const auto colWidths = getColumnWidths(columns_, rows_);
+    if (!textOutput_) {
+        flushRun();
+        flushBlock();
+    } else {
+        if (colWidths_.empty()) {
+            flushSample();
+        }
+        std::cout << std::flush;
+    }
+}
 
-        for (size_t i = 0; i < columns_.size() - 1; ++i) {
-            printPadded(columns_[i].name, colWidths[i]);
+Reader::Reader(int fd, size_t bufferSize)
+    : fd_(fd)
+{
+    struct stat st;
+    if (::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        // Someone might have read part of the file already
+        const auto start = ::lseek(fd_, 0, SEEK_CUR);
+        auto map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (start >= 0 && map != MAP_FAILED) {
+            ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+            base_ = static_cast<const char*>(map);
+            mapSize_ = st.st_size;
+            pos_ = start;
+            end_ = st.st_size;
+            eof_ = true;
+            return;
         }
-        // Print the last column without padding
-        std::cout << columns_[columns_.size() - 1].name;
+    }
+    buffer_.resize(bufferSize);
+    base_ = buffer_.data();
+}
+
+Reader::~Reader()
+{
+    if (mapped()) {
+        ::munmap(const_cast<char*>(base_), mapSize_);
+    }
+}
 
-        const auto fullWidth = std::accumulate(colWidths.begin(), colWidths.end(), 0ul);
-        std::cout << "\n" << std::string(fullWidth, '-') << std::endl;
+bool Reader::read(void* dest, size_t size)
+{
+    if (!ensure(size)) {
+        return false;
+    }
+    std::memcpy(dest, data(), size);
+    consume(size);
+    return true;
+}
 
-        for (const auto& row : rows_) {
-            for (size_t i = 0; i < columns_.size() - 1; ++i) {
-                printPadded(toString(row[i]), colWidths[i]);
+bool Reader::refill(size_t size)
+{
+    if (mapped()) {
+        return end_ - pos_ >= size;
+    }
+    if (pos_ > 0) {
+        std::memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        offset_ += pos_;
+        pos_ = 0;
+    }
+    if (size > buffer_.size()) {
+        buffer_.resize(std::max(size, buffer_.size() * 2));
+        base_ = buffer_.data();
+    }
+    while (end_ < size && !eof_) {
+        if (waitHook_) {
+            ::pollfd pfd { fd_, POLLIN, 0 };
+            if (::poll(&pfd, 1, 0) == 0) {
+                waitHook_();
+            }
+        }
+        const auto res = ::read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            std::cout << toString(row[columns_.size() - 1]);
-            std::cout << std::endl;
+            std::cerr << "Error reading input: " << std::strerror(errno) << std::endl;
+            std::exit(1);
         }
+        eof_ = res == 0;
+        end_ += res;
     }
+    return end_ >= size;
 }
 
-Input::Input()
-    : stdinIsATty_(::isatty(STDIN_FILENO))
+Input::Input(int fd)
+    : reader_(fd)
+    , block_(columns_)
+    , seekBlock_(columns_)
+    , stdinIsATty_(::isatty(fd))
 {
     char magic[MagicLen];
-    auto res = ::read(STDIN_FILENO, magic, MagicLen); // TODO
-    assert(res > 0);
-    assert(std::memcmp(Magic, magic, MagicLen) == 0);
+    if (!reader_.read(magic, MagicLen) || std::memcmp(Magic, magic, MagicLen) != 0) {
+        invalidInput("not a jutils stream");
+    }
     ColumnCount columnCount = 0;
-    res = ::read(STDIN_FILENO, &columnCount, sizeof(columnCount));
-    assert(res > 0);
+    if (!reader_.read(columnCount)) {
+        invalidInput("truncated header");
+    }
+    HeaderFlags flags = 0;
+    if (columnCount == VersionMarker) {
+        Version version = 0;
+        if (!reader_.read(version) || !reader_.read(flags) || !reader_.read(columnCount)) {
+            invalidInput("truncated header");
+        }
+        if (version < 2 || version > LatestVersion) {
+            invalidInput("unsupported version");
+        }
+        if ((flags & ~KnownHeaderFlags) != 0) {
+            invalidInput("unsupported header flags");
+        }
+        version_ = version;
+        compressed_ = flags & CompressedBlocks;
+    }
     for (size_t i = 0; i < columnCount; ++i) {
         ColumnType type = 0;
-        res = ::read(STDIN_FILENO, &type, sizeof(type));
-        assert(res > 0);
         StringLen len = 0;
-        res = ::read(STDIN_FILENO, &len, sizeof(len));
-        assert(res > 0);
+        if (!reader_.read(type) || !reader_.read(len)) {
+            invalidInput("truncated header");
+        }
         std::string name(len, 0);
-        res = ::read(STDIN_FILENO, name.data(), len);
-        assert(res > 0);
-        columns_.push_back(Column { std::move(name), static_cast<Column::Type>(type) });
+        if (!reader_.read(name.data(), len)) {
+            invalidInput("truncated header");
+        }
+        const auto colType = static_cast<Column::Type>(type);
+        if (colType != Column::Type::I64 && colType != Column::Type::String) {
+            invalidInput("unknown column type");
+        }
+        columns_.push_back(Column { std::move(name), colType });
+    }
+    if (flags & Sorted) {
+        SortKeyCount numKeys = 0;
+        if (!reader_.read(numKeys)) {
+            invalidInput("truncated header");
+        }
+        for (size_t i = 0; i < numKeys; ++i) {
+            ColumnIndex column = 0;
+            uint8_t descending = 0;
+            if (!reader_.read(column) || !reader_.read(descending)) {
+                invalidInput("truncated header");
+            }
+            if (column >= columns_.size() || descending > 1) {
+                invalidInput("invalid sort order");
+            }
+            sortedBy_.push_back(SortKey { column, descending == 1 });
+        }
     }
+    fields_.resize(columns_.size());
+    seekFields_.resize(columns_.size());
 }
 
-std::optional<std::vector<Value>> Input::row() const
+namespace {
+struct BlockHeader {
+    BlockRowCount numRows;
+    BlockSize payloadSize;
+    BlockSize rawSize;
+    size_t headerSize;
+};
+
+// `data` needs to hold at least CompressedBlockHeaderSize bytes if `compressed`, BlockHeaderSize
+// otherwise
+BlockHeader parseBlockHeader(const char* data, bool compressed)
 {
-    char rowStart[MagicLen];
-    auto res = ::read(STDIN_FILENO, rowStart, MagicLen);
-    if (res == 0) {
-        return std::nullopt;
+    if (std::memcmp(BlockStart, data, MagicLen) != 0) {
+        invalidInput("missing block marker");
     }
-    assert(res > 0);
-    assert(std::memcmp(RowStart, rowStart, MagicLen) == 0);
-    std::vector<Value> values;
-    for (size_t i = 0; i < columns_.size(); ++i) {
-        switch (columns_[i].type) {
-        case Column::Type::I64: {
-            int64_t value = 0;
-            res = ::read(STDIN_FILENO, &value, sizeof(value));
-            assert(res > 0);
-            values.push_back(value);
-            break;
-        }
-        case Column::Type::String: {
-            StringLen len = 0;
-            res = ::read(STDIN_FILENO, &len, sizeof(len));
-            assert(res > 0);
-            std::string str(len, 0);
-            if (len > 0) {
-                res = ::read(STDIN_FILENO, str.data(), len);
-                assert(res > 0);
+    BlockHeader header;
+    data += MagicLen;
+    std::memcpy(&header.numRows, data, sizeof(header.numRows));
+    data += sizeof(header.numRows);
+    std::memcpy(&header.payloadSize, data, sizeof(header.payloadSize));
+    header.rawSize = header.payloadSize;
+    header.headerSize = BlockHeaderSize;
+    if (compressed) {
+        data += sizeof(header.payloadSize);
+        std::memcpy(&header.rawSize, data, sizeof(header.rawSize));
+        header.headerSize = CompressedBlockHeaderSize;
+    }
+    return header;
+}
+}
+
+// `block` needs to point to a complete block. The payload is decompressed into `buffer` if needed.
+std::string_view Input::blockPayload(const char* block, std::string& buffer)
+{
+    const auto header = parseBlockHeader(block, compressed_);
+    const auto payload = std::string_view(block + header.headerSize, header.payloadSize);
+    if (!compressed_) {
+        return payload;
+    }
+    // Don't trust the header with the allocation: The writer makes blocks of about MaxBlockBytes,
+    // unless they contain large strings, which then also have to be in the compressed payload.
+    if (header.rawSize > MaxBlockBytes && header.rawSize / LzMaxRatio >= header.payloadSize) {
+        invalidInput("malformed compressed block");
+    }
+    buffer.resize(header.rawSize);
+    if (!lzDecompress(payload, buffer.data(), header.rawSize)) {
+        invalidInput("malformed compressed block");
+    }
+    return buffer;
+}
+
+bool Input::readBlock()
+{
+    if (blockEnd_) {
+        blockEnd_();
+    }
+    if (!reader_.ensure(1)) {
+        return false;
+    }
+    const auto headerSize = compressed_ ? CompressedBlockHeaderSize : BlockHeaderSize;
+    if (!reader_.ensure(headerSize)) {
+        invalidInput("truncated block");
+    }
+    const auto header = parseBlockHeader(reader_.data(), compressed_);
+    if (!reader_.ensure(headerSize + header.payloadSize)) {
+        invalidInput("truncated block");
+    }
+    // The payload stays in the read buffer until the next ensure(). Only one decompressed block
+    // is kept at a time.
+    const auto payload = blockPayload(reader_.data(), decompressed_);
+    if (!block_.decode(payload, header.numRows, neededColumns_)) {
+        invalidInput("malformed block");
+    }
+    block_.setEncoded(std::string_view(reader_.data(), headerSize + header.payloadSize));
+    blockOffset_ = reader_.position();
+    reader_.consume(headerSize + header.payloadSize);
+    blockRow_ = 0;
+    return true;
+}
+
+RowLocation Input::location() const
+{
+    if (version_ > 1) {
+        assert(blockRow_ > 0);
+        return RowLocation { blockOffset_, blockRow_ - 1 };
+    }
+    return RowLocation { rowOffset_, 0 };
+}
+
+RowView Input::rowAt(RowLocation location)
+{
+    assert(seekable());
+    const auto mapping = reader_.mapping();
+    assert(location.offset < mapping.size());
+    const auto data = mapping.data() + location.offset;
+    const auto size = mapping.size() - location.offset;
+    if (version_ > 1) {
+        if (seekBlockOffset_ != location.offset) {
+            // Only locations we handed out are passed in here, so this has been validated before
+            const auto header = parseBlockHeader(data, compressed_);
+            seekBlock_.decode(blockPayload(data, seekDecompressed_), header.numRows);
+            seekBlockOffset_ = location.offset;
+        }
+        return seekBlock_.row(location.index, seekFields_.data());
+    }
+    const auto rowSize = decodeRow(columns_, data, size, seekFields_.data());
+    assert(rowSize <= size);
+    return RowView(columns_, seekFields_.data(), std::string_view(data, rowSize));
+}
+
+void Input::skip(size_t count)
+{
+    blockRow_ = std::min(blockRow_ + count, block_.size());
+}
+
+std::optional<RowView> Input::rowView()
+{
+    if (version_ > 1) {
+        while (blockRow_ >= block_.size()) {
+            if (!readBlock()) {
+                return std::nullopt;
             }
-            values.push_back(str);
-            break;
         }
-        case Column::Type::Invalid:
-            std::abort();
+        return block_.row(blockRow_++, fields_.data());
+    }
+
+    if (!reader_.ensure(1)) {
+        return std::nullopt;
+    }
+    size_t size = 0;
+    while ((size = decodeRow(columns_, reader_.data(), reader_.available(), fields_.data()))
+        > reader_.available()) {
+        if (!reader_.ensure(size)) {
+            invalidInput("truncated row");
         }
     }
-    return values;
+    const auto raw = std::string_view(reader_.data(), size);
+    rowOffset_ = reader_.position();
+    // The memory stays valid until the next ensure()
+    reader_.consume(size);
+    return RowView(columns_, fields_.data(), raw);
+}
+
+std::optional<std::vector<Value>> Input::row()
+{
+    const auto view = rowView();
+    if (!view) {
+        return std::nullopt;
+    }
+    return view->values();
 }
 
-std::vector<std::vector<Value>> Input::rows() const
+std::vector<std::vector<Value>> Input::rows()
 {
     std::vector<std::vector<Value>> ret;
-    while (const auto r = row()) {
-        ret.push_back(r.value());
+    while (auto r = row()) {
+        ret.push_back(std::move(r.value()));
     }
     return ret;
 }
+
+RowArena::RowArena(const std::vector<Column>& columns)
+    : columns_(&columns)
+    , fields_(columns.size())
+{
+}
+
+void RowArena::push(const RowView& row)
+{
+    // Not the version 1 encoding, because strings of version 2 streams may not fit its lengths
+    offsets_.push_back(data_.size());
+    StringSink sink { data_ };
+    for (size_t i = 0; i < columns_->size(); ++i) {
+        if ((*columns_)[i].type == Column::Type::I64) {
+            sink.write(row.i64(i));
+        } else {
+            const auto str = row.str(i);
+            if (str.size() > std::numeric_limits<ArenaStringLen>::max()) {
+                invalidInput("string too long");
+            }
+            sink.write(static_cast<ArenaStringLen>(str.size()));
+            sink.write(str.data(), str.size());
+        }
+    }
+}
+
+RowView RowArena::operator[](size_t idx)
+{
+    const auto start = offsets_[idx];
+    const auto end = idx + 1 < offsets_.size() ? offsets_[idx + 1] : data_.size();
+    // Checked even without asserts, so a bug in the encoding can't produce a corrupt output row
+    const auto corrupt = []() {
+        std::cerr << "Internal error: corrupt row arena" << std::endl;
+        std::abort();
+    };
+    const char* ptr = data_.data() + start;
+    const char* rowEnd = data_.data() + end;
+    for (size_t i = 0; i < columns_->size(); ++i) {
+        if ((*columns_)[i].type == Column::Type::I64) {
+            if (rowEnd - ptr < static_cast<ptrdiff_t>(sizeof(int64_t))) {
+                corrupt();
+            }
+            std::memcpy(&fields_[i].i64, ptr, sizeof(int64_t));
+            ptr += sizeof(int64_t);
+        } else {
+            ArenaStringLen len = 0;
+            if (rowEnd - ptr < static_cast<ptrdiff_t>(sizeof(len))) {
+                corrupt();
+            }
+            std::memcpy(&len, ptr, sizeof(len));
+            ptr += sizeof(len);
+            if (static_cast<size_t>(rowEnd - ptr) < len) {
+                corrupt();
+            }
+            fields_[i].str = std::string_view(ptr, len);
+            ptr += len;
+        }
+    }
+    if (ptr != rowEnd) {
+        corrupt();
+    }
+    return RowView(*columns_, fields_.data());
+}
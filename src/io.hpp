@@ -1,10 +1,16 @@
 #pragma once
 
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
+#include <unistd.h>
+
 struct Column {
     enum class Type {
         Invalid,
@@ -17,32 +23,438 @@ struct Column {
 };
 using Value = std::variant<int64_t, std::string>;
 
+struct SortKey {
+    size_t column;
+    bool descending;
+};
+
+struct FieldView {
+    int64_t i64 = 0;
+    std::string_view str;
+    // For dictionary encoded strings: A non-zero id that is unique for every dictionary and the
+    // index of the string in it. Equal codes in the same dictionary mean equal strings.
+    uint64_t dictionary = 0;
+    uint32_t code = 0;
+};
+
+class Block;
+
+// A row that points into memory owned by someone else (usually the buffer of an Input). It is only
+// valid until the owner produces the next row.
+class RowView {
+public:
+    RowView(const std::vector<Column>& columns, const FieldView* fields, std::string_view raw = {})
+        : columns_(&columns)
+        , fields_(fields)
+        , raw_(raw)
+    {
+    }
+
+    RowView(const Block& block, size_t index, const FieldView* fields, bool complete = true);
+
+    size_t size() const { return columns_->size(); }
+    const auto& columns() const { return *columns_; }
+
+    int64_t i64(size_t idx) const { return fields_[idx].i64; }
+    std::string_view str(size_t idx) const { return fields_[idx].str; }
+    uint64_t dictionary(size_t idx) const { return fields_[idx].dictionary; }
+    uint32_t code(size_t idx) const { return fields_[idx].code; }
+    const FieldView& field(size_t idx) const { return fields_[idx]; }
+
+    Value value(size_t idx) const;
+    std::vector<Value> values() const;
+
+    // The complete encoded row (including the row marker) if it is available in one piece
+    std::string_view raw() const { return raw_; }
+
+    // The block the row was taken from (if any) and its index in that block
+    const Block* block() const { return block_; }
+    size_t blockIndex() const { return blockIndex_; }
+    // Whether all fields are set (see Input::needColumns)
+    bool complete() const { return complete_; }
+
+private:
+    const std::vector<Column>* columns_;
+    const FieldView* fields_;
+    std::string_view raw_;
+    const Block* block_ = nullptr;
+    size_t blockIndex_ = 0;
+    bool complete_ = true;
+};
+
+// Remembers a value per string for dictionary encoded string fields, so that something that only
+// depends on the string has to be computed only once per distinct string in a dictionary.
+template <typename T>
+class DictionaryCache {
+public:
+    // Returns nullptr if the field is not dictionary encoded. Otherwise the returned value is
+    // empty, if nothing has been cached for this string yet.
+    std::optional<T>* find(const RowView& row, size_t idx)
+    {
+        return find(row.dictionary(idx), row.code(idx));
+    }
+
+    std::optional<T>* find(uint64_t dictionary, uint32_t code)
+    {
+        if (dictionary == 0) {
+            return nullptr;
+        }
+        if (dictionary != dictionary_) {
+            dictionary_ = dictionary;
+            values_.clear();
+        }
+        if (code >= values_.size()) {
+            values_.resize(code + 1);
+        }
+        return &values_[code];
+    }
+
+private:
+    uint64_t dictionary_ = 0;
+    std::vector<std::optional<T>> values_;
+};
+
+class Reader;
+
+// Collects small writes in a buffer and hands them to the kernel in big chunks.
+// The buffer size defaults to 256 KiB and can be changed with JUTILS_BUFFER_SIZE.
+class Writer {
+public:
+    Writer(int fd = STDOUT_FILENO, size_t bufferSize = defaultBufferSize());
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void write(const void* data, size_t size)
+    {
+        if (size_ + size > buffer_.size()) {
+            writeSlow(data, size);
+            return;
+        }
+        std::memcpy(buffer_.data() + size_, data, size);
+        size_ += size;
+    }
+
+    template <typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(&value, sizeof(T));
+    }
+
+    void flush();
+
+    // Writes everything that is left in `reader`, which is at its end afterwards.
+    // If both file descriptors are pipes, the data does not pass through user space.
+    void copyRest(Reader& reader);
+
+    static size_t defaultBufferSize();
+
+private:
+    void writeSlow(const void* data, size_t size);
+
+    int fd_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+};
+
+// A group of rows stored column by column, which is how version 2 streams are encoded.
+// Integer columns are contiguous int64_t arrays, string columns are offsets into a byte array.
+// String columns with few distinct values are encoded as a dictionary of the distinct values and
+// a code (index into the dictionary) per row.
+// Optionally integer columns are encoded as zigzag varints, either of the values themselves or of
+// the difference to the previous value (whichever is smaller).
+class Block {
+public:
+    Block(const std::vector<Column>& columns);
+
+    size_t size() const { return size_; }
+    size_t byteSize() const;
+    const auto& columns() const { return *columns_; }
+
+    const int64_t* i64s(size_t col) const { return data_[col].i64s.data(); }
+    int64_t i64(size_t col, size_t row) const { return data_[col].i64s[row]; }
+    std::string_view str(size_t col, size_t row) const
+    {
+        const auto& data = data_[col];
+        const auto idx = data.dictionary ? data.codes[row] : row;
+        return data.bytes.substr(data.offsets[idx], data.offsets[idx + 1] - data.offsets[idx]);
+    }
+    // See FieldView
+    uint64_t dictionary(size_t col) const { return data_[col].dictionary; }
+    uint32_t code(size_t col, size_t row) const
+    {
+        return data_[col].dictionary ? data_[col].codes[row] : 0;
+    }
+
+    // The returned view uses `fields`, which needs to hold one element per column. The fields of
+    // columns that have been skipped by decode() are left alone.
+    RowView row(size_t row, FieldView* fields) const;
+
+    void clear();
+    void push(const std::vector<Value>& values);
+    void push(const RowView& row);
+
+    // Appends the encoded payload to `payload`
+    void encode(std::string& payload, bool compactIntegers = false) const;
+    // Decodes a payload produced by encode. String bytes are not copied, so `payload` needs to
+    // outlive the decoded values. Returns false if the payload is malformed.
+    // Columns that are not `needed` (if it's not empty) are skipped, only their size is read.
+    bool decode(std::string_view payload, size_t numRows, const std::vector<bool>& needed = {});
+    // Decodes the columns that decode() skipped, if any. `payload` still needs to be around.
+    // This doesn't change the values of the block, so it can be done through a const reference.
+    bool decodeSkipped() const;
+
+    // The complete encoded block (header and payload) this block was decoded from, if whoever
+    // decoded it keeps it in memory. It is reset by clear().
+    std::string_view encoded() const { return encoded_; }
+    void setEncoded(std::string_view encoded) { encoded_ = encoded; }
+    // The encoded payload of a single column, if the block was decoded from a payload (which
+    // still needs to be around)
+    std::string_view encodedColumn(size_t col) const { return data_[col].encoded; }
+
+private:
+    struct ColumnData {
+        std::vector<int64_t> i64s;
+        // If the column is dictionary encoded, offsets and bytes hold the dictionary entries
+        std::vector<uint32_t> offsets;
+        std::string ownedBytes;
+        // Either points to ownedBytes or into the decoded payload
+        std::string_view bytes;
+        uint64_t dictionary = 0;
+        std::vector<uint32_t> codes;
+        std::string_view encoded;
+        // The encoded column, if decode() skipped it
+        std::string_view skipped;
+    };
+
+    void pushStr(ColumnData& data, std::string_view str);
+    bool decodeColumn(size_t col, std::string_view payload, size_t& offset, size_t numRows) const;
+    bool skipColumn(size_t col, std::string_view payload, size_t& offset, size_t numRows) const;
+
+    const std::vector<Column>* columns_;
+    // Skipped columns are decoded lazily
+    mutable std::vector<ColumnData> data_;
+    size_t size_ = 0;
+    std::string_view encoded_;
+};
+
+class Input;
+
 class Output {
 public:
-    Output(std::vector<Column> columns);
+    // `sortedBy` is recorded in the header (if the format supports it). It's a promise that the
+    // rows passed to row() are sorted by these keys.
+    Output(std::vector<Column> columns, std::vector<SortKey> sortedBy = {}, int fd = STDOUT_FILENO);
     ~Output();
 
     void row(const std::vector<Value>& values);
+    // Rows that are still encoded (raw() is not empty) are copied as they are. Columns of the
+    // row's block that the input skipped are decoded.
+    void row(const RowView& row);
+    // Writes the columns `indices` of `row`, e.g. for a row of an input with other columns
+    void row(const RowView& row, const std::vector<size_t>& indices);
+
+    // Rows of `input` are passed to row() in their original order (with some left out), so if all
+    // rows of an input block are passed, the block is copied as it is.
+    void passthrough(Input& input);
+    // The same for rows that are passed to row(row, indices) with these `indices`. The encoded
+    // columns of blocks that are passed whole are copied. If that is possible, `input` is told not
+    // to decode any columns (see Input::needColumns).
+    void passthrough(Input& input, std::vector<size_t> indices);
+    // Passes all remaining rows of `input` to the output. If possible, their bytes are copied
+    // without looking at them, with splice(2) if both ends are pipes.
+    void copyRest(Input& input);
+    // Text output collects the first rows to determine the column widths. While `input` has no
+    // data available, they are shown as soon as the sample time is up (passthrough() does this
+    // too).
+    void watch(Input& input);
 
 private:
     void flush();
+    void flushBlock();
+    void writeBlock(size_t numRows);
+    void pushBlockRow(const RowView& row);
+    void writeRow(const RowView& row);
+    RowView completeRow(const RowView& row);
+    RowView project(const RowView& row, const std::vector<size_t>& indices);
+    bool continueRun(const RowView& row);
+    void flushRun();
+    bool canCopy(const Input& input) const;
+    void textRow(std::vector<std::string> cells);
+    void flushSample();
+    void printHeader();
+    void printRow(const std::vector<std::string>& cells);
 
     std::vector<Column> columns_;
-    std::vector<std::vector<Value>> rows_;
+    // Text output buffers only the first few rows to determine the column widths
+    std::vector<std::vector<std::string>> sample_;
+    std::chrono::steady_clock::time_point sampleStart_;
+    std::vector<size_t> colWidths_;
+    Writer writer_;
+    Block block_;
+    std::string payload_;
+    std::string compressed_;
+    int version_;
+    bool compactIntegers_;
+    bool compress_;
     bool textOutput_;
     bool flushed_ = false;
+    // For passthrough(): The leading rows of `runBlock_` that were all passed to row() so far
+    bool passthrough_ = false;
+    // Empty, unless the rows passed through are projected
+    std::vector<size_t> passthroughColumns_;
+    const Block* runBlock_ = nullptr;
+    size_t runRows_ = 0;
+    std::vector<FieldView> runFields_;
+    std::vector<FieldView> completeFields_;
+    std::vector<FieldView> projectedFields_;
+};
+
+// Reads from a file descriptor into a refillable buffer, so values can be decoded straight from
+// memory with few read(2) calls. Reads are repeated until they complete (pipes deliver partial
+// reads whenever data straddles the pipe buffer).
+// If the file descriptor refers to a regular file, it is mapped into memory instead and nothing
+// is copied at all.
+class Reader {
+public:
+    Reader(int fd = STDIN_FILENO, size_t bufferSize = Writer::defaultBufferSize());
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // Makes at least `size` bytes available at data(), growing the buffer if necessary.
+    // Returns false if the input ends before that.
+    bool ensure(size_t size)
+    {
+        return end_ - pos_ >= size || refill(size);
+    }
+
+    const char* data() const { return base_ + pos_; }
+    size_t available() const { return end_ - pos_; }
+    int fd() const { return fd_; }
+    void consume(size_t size) { pos_ += size; }
+
+    // Offset of data() from the start of the file
+    size_t position() const { return offset_ + pos_; }
+
+    bool mapped() const { return mapSize_ > 0; }
+    // The whole file, if it is mapped. Offsets into it are the same as position().
+    std::string_view mapping() const { return std::string_view(base_, mapSize_); }
+
+    // Copies exactly `size` bytes to `dest`. Returns false if the input ends before that.
+    bool read(void* dest, size_t size);
+
+    // `hook` is called before a read that would block, because no data is available yet
+    void setWaitHook(std::function<void()> hook) { waitHook_ = std::move(hook); }
+
+    template <typename T>
+    bool read(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return read(&value, sizeof(T));
+    }
+
+private:
+    bool refill(size_t size);
+
+    int fd_;
+    std::vector<char> buffer_;
+    const char* base_ = nullptr;
+    size_t mapSize_ = 0;
+    // Offset of base_ from the start of the file
+    size_t offset_ = 0;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+    std::function<void()> waitHook_;
+};
+
+// Stores encoded rows back to back, so keeping many rows around does not need an allocation per
+// row or value. The returned rows are not raw (see RowView::raw), because the encoding is not the
+// one of version 1.
+class RowArena {
+public:
+    RowArena(const std::vector<Column>& columns);
+
+    void push(const RowView& row);
+
+    size_t size() const { return offsets_.size(); }
+    size_t byteSize() const { return data_.size(); }
+
+    // The returned view is valid until the next call
+    RowView operator[](size_t idx);
+
+private:
+    // Version 2 allows strings up to 4 GiB
+    using ArenaStringLen = uint32_t;
+
+    const std::vector<Column>* columns_;
+    std::string data_;
+    std::vector<size_t> offsets_;
+    std::vector<FieldView> fields_;
+};
+
+// Where a row is stored in a seekable input: the offset of the row (version 1) or of the block
+// that contains it (version 2) and the index of the row within that block.
+struct RowLocation {
+    size_t offset;
+    size_t index;
 };
 
 class Input {
 public:
-    Input();
+    Input(int fd = STDIN_FILENO);
 
-    std::optional<std::vector<Value>> row() const;
-    std::vector<std::vector<Value>> rows() const;
+    // The returned view points into the read buffer and is valid until the next call
+    std::optional<RowView> rowView();
+    std::optional<std::vector<Value>> row();
+    std::vector<std::vector<Value>> rows();
+    // Columns that are not needed (false) are not decoded by rowView() (version 2 only). Their
+    // values in the returned rows are missing, until the row is passed to Output.
+    void needColumns(std::vector<bool> needed) { neededColumns_ = std::move(needed); }
+    // Skips up to `count` rows of the block the last row returned by rowView() came from
+    void skip(size_t count);
 
     const auto& columns() const { return columns_; }
+    int version() const { return version_; }
+    // The keys the rows are sorted by, according to the header. Might be empty, even if the rows
+    // are sorted.
+    const auto& sortedBy() const { return sortedBy_; }
+
+    // If stdin is a regular file, rows can be read again later through their location instead of
+    // having to keep them around.
+    bool seekable() const { return reader_.mapped(); }
+    // The location of the row last returned by rowView()
+    RowLocation location() const;
+    // The returned view is valid until the next call. Does not change the position of rowView().
+    RowView rowAt(RowLocation location);
 
 private:
+    friend class Output;
+
+    bool readBlock();
+    std::string_view blockPayload(const char* block, std::string& buffer);
+
+    Reader reader_;
     std::vector<Column> columns_;
+    std::vector<SortKey> sortedBy_;
+    std::vector<FieldView> fields_;
+    std::vector<bool> neededColumns_;
+    Block block_;
+    size_t blockOffset_ = 0;
+    size_t blockRow_ = 0;
+    size_t rowOffset_ = 0;
+    std::vector<FieldView> seekFields_;
+    Block seekBlock_;
+    std::optional<size_t> seekBlockOffset_;
+    std::string decompressed_;
+    std::string seekDecompressed_;
+    // Called before the current block is replaced by the next one
+    std::function<void()> blockEnd_;
+    int version_ = 1;
+    bool compressed_ = false;
     bool stdinIsATty_;
 };
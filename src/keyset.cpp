@@ -0,0 +1,156 @@
+#include "keyset.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+__extension__ typedef unsigned __int128 Uint128;
+
+// The mixing step of wyhash: A 64x64 -> 128 bit multiplication folded to 64 bits
+uint64_t mix(uint64_t a, uint64_t b)
+{
+    const auto product = static_cast<Uint128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+constexpr uint64_t P0 = 0xa0761d6478bd642full;
+constexpr uint64_t P1 = 0xe7037ed1a0b428dbull;
+constexpr uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+
+uint64_t load(const char* data, size_t size)
+{
+    uint64_t value = 0;
+    std::memcpy(&value, data, size);
+    return value;
+}
+
+// Maps a hash to [0, range) without a division
+uint64_t reduce(uint64_t hash, uint64_t range)
+{
+    return static_cast<uint64_t>((static_cast<Uint128>(hash) * range) >> 64);
+}
+}
+
+uint64_t hashBytes(std::string_view str)
+{
+    auto hash = P0;
+    size_t i = 0;
+    for (; i + 16 <= str.size(); i += 16) {
+        hash = mix(load(str.data() + i, 8) ^ P1, load(str.data() + i + 8, 8) ^ hash);
+    }
+    const auto rest = str.size() - i;
+    const auto a = rest > 0 ? load(str.data() + i, std::min<size_t>(rest, 8)) : 0;
+    const auto b = rest > 8 ? load(str.data() + i + 8, rest - 8) : 0;
+    hash = mix(a ^ P1, b ^ hash);
+    // The length tells apart strings that only differ in trailing zeros
+    return mix(hash ^ str.size(), P2);
+}
+
+uint64_t hashInt(int64_t value)
+{
+    return mix(static_cast<uint64_t>(value) ^ P1, P2);
+}
+
+uint64_t hashCombine(uint64_t seed, uint64_t hash)
+{
+    return mix(seed ^ P0, hash ^ P1);
+}
+
+KeySet::KeySet(size_t memoryLimit, double falsePositiveRate)
+    : memoryLimit_(memoryLimit)
+    , falsePositiveRate_(falsePositiveRate)
+{
+}
+
+bool KeySet::insert(uint64_t key)
+{
+    return approximate() ? insertBloom(key) : insertExact(key);
+}
+
+size_t KeySet::capacity() const
+{
+    // The optimal number of bits per key is log2(1/p) / ln(2)
+    const auto bits = static_cast<double>(bloom_.size()) * 64.0;
+    return static_cast<size_t>(bits * std::log(2.0) / std::log2(1.0 / falsePositiveRate_));
+}
+
+bool KeySet::insertExact(uint64_t key)
+{
+    if (key == 0) {
+        const auto isNew = !hasZero_;
+        hasZero_ = true;
+        return isNew;
+    }
+    // At most 3/4 of the slots are used, so runs of used slots stay short
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+        grow();
+        if (approximate()) {
+            return insertBloom(key);
+        }
+    }
+    const auto mask = slots_.size() - 1;
+    for (auto i = key & mask;; i = (i + 1) & mask) {
+        if (slots_[i] == key) {
+            return false;
+        }
+        if (slots_[i] == 0) {
+            slots_[i] = key;
+            size_++;
+            return true;
+        }
+    }
+}
+
+void KeySet::grow()
+{
+    const auto numSlots = std::max(MinSlots, slots_.size() * 2);
+    // The old table is still around while the keys are moved, so both have to fit
+    const auto tableSize = slots_.size() * sizeof(uint64_t);
+    if (numSlots * sizeof(uint64_t) + tableSize > memoryLimit_) {
+        // The optimal number of hash functions is (m/n) * ln(2) = log2(1/p)
+        numHashes_ = std::max<long>(1, std::lround(std::log2(1.0 / falsePositiveRate_)));
+        bloom_.resize(std::max<size_t>(1, (memoryLimit_ - tableSize) / sizeof(uint64_t)), 0);
+        if (hasZero_) {
+            insertBloom(0);
+        }
+        for (const auto key : slots_) {
+            if (key) {
+                insertBloom(key);
+            }
+        }
+        slots_ = std::vector<uint64_t>();
+        return;
+    }
+
+    std::vector<uint64_t> slots(numSlots, 0);
+    const auto mask = numSlots - 1;
+    for (const auto key : slots_) {
+        if (key) {
+            auto i = key & mask;
+            while (slots[i]) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = key;
+        }
+    }
+    slots_ = std::move(slots);
+}
+
+bool KeySet::insertBloom(uint64_t key)
+{
+    // The bits are derived from two hashes (h1 + i * h2), which is as good as independent ones
+    const auto numBits = bloom_.size() * 64;
+    const auto h2 = mix(key ^ P2, P0) | 1;
+    bool isNew = false;
+    auto hash = key;
+    for (size_t i = 0; i < numHashes_; ++i) {
+        const auto bit = reduce(hash, numBits);
+        auto& word = bloom_[bit / 64];
+        const auto mask = uint64_t(1) << (bit % 64);
+        isNew = isNew || !(word & mask);
+        word |= mask;
+        hash += h2;
+    }
+    return isNew;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+// A fast 64-bit hash. Keys of multiple values (e.g. the columns of a row) are built with
+// hashCombine.
+uint64_t hashBytes(std::string_view str);
+uint64_t hashInt(int64_t value);
+uint64_t hashCombine(uint64_t seed, uint64_t hash);
+
+// Remembers which 64-bit keys (hashes) have been seen. They are kept in an open addressing hash
+// table until growing it would take more than `memoryLimit` bytes. Then they are moved into a
+// Bloom filter that gets what is left of the limit next to the table, so at most `memoryLimit`
+// bytes are used at any time. The filter takes a new key for one it has seen before with a
+// probability of about `falsePositiveRate` as long as it holds at most capacity() keys (and more
+// often after that).
+class KeySet {
+public:
+    explicit KeySet(size_t memoryLimit = std::numeric_limits<size_t>::max(),
+        double falsePositiveRate = 0.01);
+
+    // Returns whether `key` has not been seen before
+    bool insert(uint64_t key);
+
+    bool approximate() const { return !bloom_.empty(); }
+    // How many keys the Bloom filter holds with the configured false positive rate
+    size_t capacity() const;
+
+private:
+    static constexpr size_t MinSlots = 1024;
+
+    bool insertExact(uint64_t key);
+    bool insertBloom(uint64_t key);
+    void grow();
+
+    size_t memoryLimit_;
+    double falsePositiveRate_;
+    // 0 marks an empty slot, so the key 0 is stored in hasZero_
+    std::vector<uint64_t> slots_;
+    size_t size_ = 0;
+    bool hasZero_ = false;
+    std::vector<uint64_t> bloom_;
+    size_t numHashes_ = 0;
+};
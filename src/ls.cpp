@@ -10,7 +10,9 @@
 
 #include <clipp/clipp.hpp>
 
+#include "expr.hpp"
 #include "io.hpp"
+#include "util.hpp"
 
 namespace {
 struct LsArgs : clipp::ArgsBase {
@@ -20,6 +22,8 @@ struct LsArgs : clipp::ArgsBase {
     bool followSymlinks = false;
     bool absPath = false;
     bool directories = false;
+    std::optional<std::string> where;
+    std::optional<std::string> columns;
     std::vector<std::string> paths;
 
     void args()
@@ -31,8 +35,22 @@ struct LsArgs : clipp::ArgsBase {
         flag(absPath, "abspath", 'p').help("Absolute paths");
         flag(directories, "directories", 'd')
             .help("List directories themeselves, not their content");
+        flag(where, "where", 'w')
+            .help("Only list files that match this jfilter expression. Conditions on name, type "
+                  "and inode are checked before a file is stat-ed.");
+        flag(columns, "columns", 'c')
+            .help("Only list these columns (comma separated). Files are only stat-ed if one of "
+                  "them (or --where) needs it.");
         positional(paths, "paths").optional();
     }
+
+    std::string description() const override
+    {
+        return R"(
+jls -s --where 'name endswith .cpp and size > 10000'
+jls -s --columns name,size
+)";
+    }
 };
 
 enum class FileType {
@@ -137,9 +155,26 @@ std::string getLinkTarget(const std::string& path)
     return std::string(target, res);
 }
 
-void entry(
-    Output& output, const std::string& path, FileType type, int64_t inode, const LsArgs& args)
+// What entry() needs besides the file itself
+struct Listing {
+    const LsArgs& args;
+    Filter& where;
+    const Projection& projection;
+    Output& output;
+    // Columns that neither --columns nor --where need are left empty
+    bool needTarget;
+    bool needStat;
+    bool needUser;
+    bool needGroup;
+    bool needMtime;
+};
+
+void entry(Listing& listing, const std::string& path, FileType type, int64_t inode)
 {
+    const auto& args = listing.args;
+    auto& where = listing.where;
+
+    // The columns are computed in order and the row is dropped as soon as it can't match
     std::vector<Value> values;
     if (args.absPath) {
         values.push_back(getCwd() + "/" + path);
@@ -148,23 +183,37 @@ void entry(
     }
     values.push_back(toString(type));
     values.push_back(static_cast<int64_t>(inode));
+    if (where.rejects(values)) {
+        return;
+    }
 
-    if (type == FileType::Link) {
+    if (listing.needTarget && type == FileType::Link) {
         values.push_back(getLinkTarget(path));
     } else {
         values.push_back(std::string(""));
     }
+    if (where.rejects(values)) {
+        return;
+    }
 
-    if (args.stat) {
+    if (listing.needStat) {
         const auto st = lstat(path);
 
         values.push_back(modeToString(st.st_mode));
 
-        const auto user = ::getpwuid(st.st_uid);
-        values.push_back(std::string(user->pw_name));
+        if (listing.needUser) {
+            const auto user = ::getpwuid(st.st_uid);
+            values.push_back(std::string(user->pw_name));
+        } else {
+            values.push_back(std::string(""));
+        }
 
-        const auto group = ::getgrgid(st.st_gid);
-        values.push_back(std::string(group->gr_name));
+        if (listing.needGroup) {
+            const auto group = ::getgrgid(st.st_gid);
+            values.push_back(std::string(group->gr_name));
+        } else {
+            values.push_back(std::string(""));
+        }
 
         if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
             values.push_back(st.st_size);
@@ -172,23 +221,41 @@ void entry(
             values.push_back(0);
         }
 
-        char timebuf[32];
-        const auto tm = std::localtime(&st.st_mtime);
-        const auto sres = std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", tm);
-        if (sres == 0) {
-            std::cerr << "Could not format modification time: " << st.st_mtime << std::endl;
-            std::exit(3);
+        if (listing.needMtime) {
+            char timebuf[32];
+            const auto tm = std::localtime(&st.st_mtime);
+            const auto sres = std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", tm);
+            if (sres == 0) {
+                std::cerr << "Could not format modification time: " << st.st_mtime << std::endl;
+                std::exit(3);
+            }
+            values.push_back(std::string(timebuf));
+        } else {
+            values.push_back(std::string(""));
+        }
+        if (where.rejects(values)) {
+            return;
         }
-        values.push_back(std::string(timebuf));
+    } else if (args.stat) {
+        // mode, user, group, size and mtime
+        values.insert(values.end(),
+            {
+                std::string(""),
+                std::string(""),
+                std::string(""),
+                static_cast<int64_t>(0),
+                std::string(""),
+            });
     }
 
-    output.row(values);
+    listing.output.row(listing.projection.apply(std::move(values)));
 }
 
-void lsDir(Output& output, const std::string& path, int64_t inode, const LsArgs& args)
+void lsDir(Listing& listing, const std::string& path, int64_t inode)
 {
+    const auto& args = listing.args;
     if (args.directories) {
-        entry(output, path, FileType::Directory, inode, args);
+        entry(listing, path, FileType::Directory, inode);
         return;
     }
 
@@ -214,7 +281,7 @@ void lsDir(Output& output, const std::string& path, int64_t inode, const LsArgs&
             name = path + "/" + name;
         }
 
-        entry(output, name, direntTypeToFileType(dirent->d_type), dirent->d_ino, args);
+        entry(listing, name, direntTypeToFileType(dirent->d_type), dirent->d_ino);
     }
     ::closedir(dir);
 }
@@ -247,11 +314,28 @@ int ls(int argc, char** argv)
         columns.push_back(Column { "mtime", Column::Type::String });
     }
 
-    Output output(columns);
+    Filter where(args.where.value_or(""), columns);
+    Projection projection(columns, args.columns);
+    projection.use(where.usedColumns());
+
+    Output output(projection.columns());
+
+    Listing listing {
+        args,
+        where,
+        projection,
+        output,
+        projection.needs("target"),
+        projection.needs("mode") || projection.needs("user") || projection.needs("group")
+            || projection.needs("size") || projection.needs("mtime"),
+        projection.needs("user"),
+        projection.needs("group"),
+        projection.needs("mtime"),
+    };
 
     if (args.paths.empty()) {
         const auto st = lstat(".");
-        lsDir(output, ".", st.st_mode, args);
+        lsDir(listing, ".", st.st_mode);
     } else {
         for (const auto& path : args.paths) {
             const auto st = lstat(path);
@@ -259,10 +343,10 @@ int ls(int argc, char** argv)
                 // remove trailing slash
                 const auto npath
                     = path[path.size() - 1] == '/' ? path.substr(0, path.size() - 1) : path;
-                lsDir(output, npath, st.st_ino, args);
+                lsDir(listing, npath, st.st_ino);
             } else {
                 // TODO: Avoid stat-ing inside this function again
-                entry(output, path, static_cast<FileType>(st.st_mode & S_IFMT), st.st_ino, args);
+                entry(listing, path, static_cast<FileType>(st.st_mode & S_IFMT), st.st_ino);
             }
         }
     }
@@ -0,0 +1,139 @@
+#include "lz.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+constexpr size_t MinMatch = 4;
+constexpr size_t MaxOffset = 0xffff;
+constexpr size_t HashBits = 14;
+
+uint32_t load32(const char* ptr)
+{
+    uint32_t v;
+    std::memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+uint32_t hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HashBits);
+}
+
+void appendLength(std::string& dst, size_t len)
+{
+    while (len >= 255) {
+        dst.push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    dst.push_back(static_cast<char>(len));
+}
+
+void appendSequence(std::string& dst, std::string_view literals, size_t offset, size_t matchLen)
+{
+    const auto litToken = std::min<size_t>(literals.size(), 15);
+    const auto matchToken = matchLen > 0 ? std::min<size_t>(matchLen - MinMatch, 15) : 0;
+    dst.push_back(static_cast<char>((litToken << 4) | matchToken));
+    if (litToken == 15) {
+        appendLength(dst, literals.size() - 15);
+    }
+    dst.append(literals);
+    if (matchLen > 0) {
+        dst.push_back(static_cast<char>(offset & 0xff));
+        dst.push_back(static_cast<char>(offset >> 8));
+        if (matchToken == 15) {
+            appendLength(dst, matchLen - MinMatch - 15);
+        }
+    }
+}
+
+bool readLength(const char*& src, const char* end, size_t& len)
+{
+    uint8_t byte = 0;
+    do {
+        if (src >= end) {
+            return false;
+        }
+        byte = static_cast<uint8_t>(*src++);
+        len += byte;
+    } while (byte == 255);
+    return true;
+}
+}
+
+void lzCompress(std::string_view src, std::string& dst)
+{
+    std::vector<uint32_t> table(1 << HashBits, 0);
+    const auto base = src.data();
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (src.size() >= MinMatch && pos <= src.size() - MinMatch) {
+        const auto seq = load32(base + pos);
+        auto& entry = table[hash(seq)];
+        const size_t candidate = entry;
+        entry = static_cast<uint32_t>(pos);
+        if (candidate >= pos || pos - candidate > MaxOffset || load32(base + candidate) != seq) {
+            // Skip faster through data that does not compress
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        size_t len = MinMatch;
+        while (pos + len < src.size() && base[candidate + len] == base[pos + len]) {
+            len++;
+        }
+        appendSequence(dst, src.substr(anchor, pos - anchor), pos - candidate, len);
+        pos += len;
+        anchor = pos;
+    }
+    appendSequence(dst, src.substr(anchor), 0, 0);
+}
+
+bool lzDecompress(std::string_view src, char* dst, size_t size)
+{
+    const char* in = src.data();
+    const char* inEnd = src.data() + src.size();
+    size_t out = 0;
+    while (in < inEnd) {
+        const auto token = static_cast<uint8_t>(*in++);
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !readLength(in, inEnd, litLen)) {
+            return false;
+        }
+        if (litLen > static_cast<size_t>(inEnd - in) || litLen > size - out) {
+            return false;
+        }
+        std::memcpy(dst + out, in, litLen);
+        in += litLen;
+        out += litLen;
+        if (in == inEnd) {
+            break;
+        }
+
+        if (inEnd - in < 2) {
+            return false;
+        }
+        const size_t offset = static_cast<uint8_t>(in[0]) | (static_cast<uint8_t>(in[1]) << 8);
+        in += 2;
+        size_t matchLen = token & 0xf;
+        if (matchLen == 15 && !readLength(in, inEnd, matchLen)) {
+            return false;
+        }
+        matchLen += MinMatch;
+        if (offset == 0 || offset > out || matchLen > size - out) {
+            return false;
+        }
+        const char* match = dst + out - offset;
+        if (offset >= matchLen) {
+            std::memcpy(dst + out, match, matchLen);
+        } else {
+            // The match overlaps the bytes it produces, so copy byte by byte
+            for (size_t i = 0; i < matchLen; ++i) {
+                dst[out + i] = match[i];
+            }
+        }
+        out += matchLen;
+    }
+    return out == size;
+}
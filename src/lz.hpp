@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// A small LZ77 codec in the spirit of LZ4: fast, not particularly strong, no dependencies.
+// The compressed data is a sequence of (literal run, back reference) pairs:
+//   token: u8 (high nibble: literal length, low nibble: match length - MinMatch, 15 means "more")
+//   [literal length extension: u8 * n, each 255 means "more"]
+//   literals
+//   offset: u16 (omitted if the literals reach the end of the compressed data)
+//   [match length extension: u8 * n, each 255 means "more"]
+
+// A back reference of 3 + n bytes produces at most 19 + 255 * n bytes, so the decompressed data is
+// always less than this many times as large as the compressed data
+constexpr size_t LzMaxRatio = 255;
+
+// Appends the compressed data to `dst`
+void lzCompress(std::string_view src, std::string& dst);
+
+// Decompresses into `dst`, which must have room for exactly `size` bytes.
+// Returns false if the data is malformed or does not decompress to exactly `size` bytes.
+bool lzDecompress(std::string_view src, char* dst, size_t size);
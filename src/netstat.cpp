@@ -17,6 +17,7 @@
 
 #include <clipp/clipp.hpp>
 
+#include "expr.hpp"
 #include "io.hpp"
 #include "util.hpp"
 
@@ -37,6 +38,8 @@ struct NetstatArgs : clipp::ArgsBase {
     bool ipv4 = false;
     bool ipv6 = false;
     bool process = false;
+    std::optional<std::string> where;
+    std::optional<std::string> columns;
 
     void args()
     {
@@ -45,6 +48,21 @@ struct NetstatArgs : clipp::ArgsBase {
         flag(ipv4, "ipv4", '4');
         flag(ipv6, "ipv6", '6');
         flag(process, "process", 'p');
+        flag(where, "where", 'w')
+            .help("Only display sockets that match this jfilter expression. With --process, "
+                  "processes are only looked up once a socket matches without the process "
+                  "columns.");
+        flag(columns, "columns", 'c')
+            .help("Only display these columns (comma separated). With --process, processes are "
+                  "only looked up if one of fd, pid and comm is displayed (or used by --where).");
+    }
+
+    std::string description() const override
+    {
+        return R"(
+jnetstat -p --where 'state == LISTEN and srcport < 1024'
+jnetstat --columns srcport,state
+)";
     }
 };
 
@@ -190,7 +208,7 @@ std::unordered_map<uint32_t, std::vector<Socket>>& getSocketInodeMap()
 
 // This is roughly taken from the ss source code and it doing it this way suggests, there is no
 // nice(r) way to get the pid from a socket inode.
-void initSocketInodeMap()
+void initSocketInodeMap(bool needComm)
 {
     auto procDir = ::opendir("/proc/");
     if (!procDir) {
@@ -220,16 +238,11 @@ void initSocketInodeMap()
             continue;
         }
 
-        // This seems to be exactly the same as the second field of /stat (which is what ss uses),
-        // but easier to retrieve
-        const auto commPath = procPath + "/comm";
-        const auto commFileData = readFile(commPath);
-        if (!commFileData) {
-            std::cerr << "Could not read " << commPath << std::endl;
-            continue;
+        // Only read for processes that have a socket (and only if it's needed at all)
+        std::optional<std::string> comm;
+        if (!needComm) {
+            comm = "";
         }
-        // Remove trailing newline
-        const auto comm = commFileData->substr(0, commFileData->size() - 1);
 
         ::dirent* fdDirent;
         while ((fdDirent = ::readdir(fdDir))) {
@@ -257,7 +270,20 @@ void initSocketInodeMap()
                 continue;
             }
 
-            socketInodeMap[inode].push_back(Socket { fd, pid, comm });
+            if (!comm) {
+                // This seems to be exactly the same as the second field of /stat (which is what ss
+                // uses), but easier to retrieve
+                const auto commPath = procPath + "/comm";
+                const auto commFileData = readFile(commPath);
+                if (!commFileData) {
+                    std::cerr << "Could not read " << commPath << std::endl;
+                    break;
+                }
+                // Remove trailing newline
+                comm = commFileData->substr(0, commFileData->size() - 1);
+            }
+
+            socketInodeMap[inode].push_back(Socket { fd, pid, *comm });
         }
         ::closedir(fdDir);
     }
@@ -273,50 +299,100 @@ std::string addrToString(int family, const void* addr)
     return buf;
 }
 
-bool processNetlinkMessage(const inet_diag_msg& msg, Output& output, const NetstatArgs& args)
+struct SocketRow {
+    uint32_t inode;
+    std::vector<Value> values;
+};
+
+// Columns that neither --columns nor --where need are left empty
+struct NeededColumns {
+    bool srcaddr;
+    bool dstaddr;
+    bool user;
+};
+
+// Where the sockets go after they have been filtered
+struct SocketOutput {
+    const NetstatArgs& args;
+    Filter& where;
+    const Projection& projection;
+    Output& output;
+    bool needProcess;
+    bool needComm;
+    bool haveProcesses = false;
+};
+
+void addProcessColumns(SocketRow& row)
+{
+    const auto& map = getSocketInodeMap();
+    const auto it = map.find(row.inode);
+    if (it == map.end()) {
+        // Might just be a race condition, which is impossible to prevent
+        row.values.push_back(static_cast<int64_t>(-1));
+        row.values.push_back(static_cast<int64_t>(-1));
+        row.values.push_back(std::string(""));
+    } else {
+        assert(it->second.size() > 0);
+        // TODO: Figure out what to do here!
+        row.values.push_back(static_cast<int64_t>(it->second[0].fd));
+        row.values.push_back(static_cast<int64_t>(it->second[0].pid));
+        row.values.push_back(it->second[0].comm);
+    }
+}
+
+// The sockets are joined with their processes after they have been filtered, so /proc/ is only
+// scanned once a socket comes along that matches without the process columns.
+void outputSocket(SocketOutput& out, SocketRow row)
+{
+    if (out.needProcess) {
+        if (!out.haveProcesses) {
+            initSocketInodeMap(out.needComm);
+            out.haveProcesses = true;
+        }
+        addProcessColumns(row);
+        if (out.where.rejects(row.values)) {
+            return;
+        }
+    } else if (out.args.process) {
+        // fd, pid and comm
+        row.values.push_back(static_cast<int64_t>(0));
+        row.values.push_back(static_cast<int64_t>(0));
+        row.values.push_back(std::string(""));
+    }
+    out.output.row(out.projection.apply(std::move(row.values)));
+}
+
+// Outputs the socket, unless it doesn't match `where`
+bool processNetlinkMessage(const inet_diag_msg& msg, const NeededColumns& needed, SocketOutput& out)
 {
     if (msg.idiag_family != AF_INET && msg.idiag_family != AF_INET6) {
         std::cerr << "Unexpected family in netlink response: " << msg.idiag_family << std::endl;
         return false;
     }
-    const auto user = ::getpwuid(msg.idiag_uid);
+    const auto user = needed.user ? ::getpwuid(msg.idiag_uid) : nullptr;
     std::vector<Value> values {
         toString(static_cast<IpFamily>(msg.idiag_family)),
         toString(static_cast<TcpState>(msg.idiag_state)),
         static_cast<int64_t>(msg.idiag_timer),
         static_cast<int64_t>(msg.idiag_retrans),
         static_cast<int64_t>(msg.idiag_expires),
-        addrToString(msg.idiag_family, &msg.id.idiag_src),
+        needed.srcaddr ? addrToString(msg.idiag_family, &msg.id.idiag_src) : std::string(),
         static_cast<int64_t>(::ntohs(msg.id.idiag_sport)),
-        addrToString(msg.idiag_family, &msg.id.idiag_dst),
+        needed.dstaddr ? addrToString(msg.idiag_family, &msg.id.idiag_dst) : std::string(),
         static_cast<int64_t>(::ntohs(msg.id.idiag_dport)),
         // idiag_if could be good
         static_cast<int64_t>(msg.idiag_rqueue),
         static_cast<int64_t>(msg.idiag_wqueue),
-        user ? std::string(user->pw_name) : std::string("<ERROR>"),
+        user ? std::string(user->pw_name) : std::string(needed.user ? "<ERROR>" : ""),
         static_cast<int64_t>(msg.idiag_inode),
     };
-    if (args.process) {
-        const auto& map = getSocketInodeMap();
-        const auto it = map.find(msg.idiag_inode);
-        if (it == map.end()) {
-            // Might just be a race condition, which is impossible to prevent
-            values.push_back(static_cast<int64_t>(-1));
-            values.push_back(static_cast<int64_t>(-1));
-            values.push_back(std::string(""));
-        } else {
-            assert(it->second.size() > 0);
-            // TODO: Figure out what to do here!
-            values.push_back(static_cast<int64_t>(it->second[0].fd));
-            values.push_back(static_cast<int64_t>(it->second[0].pid));
-            values.push_back(it->second[0].comm);
-        }
+    if (!out.where.rejects(values)) {
+        outputSocket(out, SocketRow { msg.idiag_inode, std::move(values) });
     }
-    output.row(values);
     return true;
 }
 
-bool processNetlinkResponse(int fd, Output& output, const NetstatArgs& args)
+bool processNetlinkResponse(int fd, const NeededColumns& needed, SocketOutput& out)
 {
     char recvBuffer[4096];
     while (true) {
@@ -344,7 +420,7 @@ bool processNetlinkResponse(int fd, Output& output, const NetstatArgs& args)
             }
 
             const auto data = reinterpret_cast<const ::inet_diag_msg*>(NLMSG_DATA(header));
-            if (!processNetlinkMessage(*data, output, args)) {
+            if (!processNetlinkMessage(*data, needed, out)) {
                 return false;
             }
             header = NLMSG_NEXT(header, num);
@@ -383,7 +459,6 @@ int netstat(int argc, char** argv)
         columns.push_back({ "fd", Column::Type::I64 });
         columns.push_back({ "pid", Column::Type::I64 });
         columns.push_back({ "comm", Column::Type::String });
-        initSocketInodeMap();
     }
 
     const auto defaultProtocols = !args.tcp && !args.udp;
@@ -404,7 +479,18 @@ int netstat(int argc, char** argv)
         families.push_back(IpFamily::v6);
     }
 
-    Output output(columns);
+    Filter where(args.where.value_or(""), columns);
+    Projection projection(columns, args.columns);
+    projection.use(where.usedColumns());
+    const NeededColumns needed {
+        projection.needs("srcaddr"),
+        projection.needs("dstaddr"),
+        projection.needs("user"),
+    };
+    const auto needProcess
+        = projection.needs("fd") || projection.needs("pid") || projection.needs("comm");
+
+    Output output(projection.columns());
 
     const auto diagSocket = ::socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
     if (diagSocket == -1) {
@@ -412,6 +498,7 @@ int netstat(int argc, char** argv)
         return 2;
     }
 
+    SocketOutput out { args, where, projection, output, needProcess, projection.needs("comm") };
     for (const auto protocol : protocols) {
         for (const auto family : families) {
             auto req = makeInetRequest(family, protocol);
@@ -421,7 +508,7 @@ int netstat(int argc, char** argv)
                           << std::endl;
                 return 3;
             }
-            if (!processNetlinkResponse(diagSocket, output, args)) {
+            if (!processNetlinkResponse(diagSocket, needed, out)) {
                 std::cerr << "Could not process netlink response "
                           << "(" << toString(family) << "/" << toString(protocol) << ")"
                           << std::endl;
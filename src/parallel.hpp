@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Calls fn(i) for every i in [0, count) on up to `threads` threads (including the calling one)
+template <typename Fn>
+void parallelFor(size_t count, size_t threads, Fn fn)
+{
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+    std::atomic<size_t> next { 0 };
+    auto work = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads - 1; ++i) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+namespace detail {
+// The number of elements to take from `a` for the first `diag` elements of the stable merge of
+// `a` and `b` (equal elements are taken from `a` first)
+template <typename It, typename Less>
+size_t mergeSplit(It a, size_t aSize, It b, size_t bSize, size_t diag, Less& less)
+{
+    size_t lo = diag > bSize ? diag - bSize : 0;
+    size_t hi = std::min(diag, aSize);
+    while (lo < hi) {
+        const auto mid = lo + (hi - lo) / 2;
+        if (!less(b[diag - mid - 1], a[mid])) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+}
+
+// Like std::stable_sort, but sorts parts of `data` on `threads` threads and then merges them
+// pairwise, splitting every merge into pieces that are done in parallel as well.
+template <typename T, typename Less>
+void parallelStableSort(std::vector<T>& data, Less less, size_t threads)
+{
+    constexpr size_t MinPartSize = 16 * 1024;
+    const auto size = data.size();
+    threads = std::min(threads, size / MinPartSize);
+    if (threads <= 1) {
+        std::stable_sort(data.begin(), data.end(), less);
+        return;
+    }
+
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= threads; ++i) {
+        bounds.push_back(size * i / threads);
+    }
+    parallelFor(threads, threads, [&](size_t i) {
+        std::stable_sort(data.begin() + bounds[i], data.begin() + bounds[i + 1], less);
+    });
+
+    struct Piece {
+        size_t a, aEnd, b, bEnd, out;
+    };
+    std::vector<T> buffer(size);
+    auto src = &data;
+    auto dst = &buffer;
+    while (bounds.size() > 2) {
+        const auto numParts = bounds.size() - 1;
+        const auto piecesPerMerge = std::max<size_t>(1, threads / (numParts / 2));
+        std::vector<Piece> pieces;
+        std::vector<size_t> newBounds;
+        for (size_t p = 0; p < numParts; p += 2) {
+            const auto start = bounds[p];
+            const auto mid = bounds[p + 1];
+            // An odd part out is merged with nothing, i.e. copied
+            const auto end = p + 2 < bounds.size() ? bounds[p + 2] : mid;
+            newBounds.push_back(start);
+            const auto a = src->begin() + start;
+            const auto b = src->begin() + mid;
+            size_t aSplit = 0;
+            for (size_t i = 1; i <= piecesPerMerge; ++i) {
+                const auto diag = (end - start) * i / piecesPerMerge;
+                const auto aNext = i == piecesPerMerge
+                    ? mid - start
+                    : detail::mergeSplit(a, mid - start, b, end - mid, diag, less);
+                const auto prevDiag = (end - start) * (i - 1) / piecesPerMerge;
+                pieces.push_back(Piece { start + aSplit, start + aNext,
+                    mid + (prevDiag - aSplit), mid + (diag - aNext), start + prevDiag });
+                aSplit = aNext;
+            }
+        }
+        newBounds.push_back(size);
+
+        parallelFor(pieces.size(), threads, [&](size_t i) {
+            const auto& piece = pieces[i];
+            std::merge(src->begin() + piece.a, src->begin() + piece.aEnd, src->begin() + piece.b,
+                src->begin() + piece.bEnd, dst->begin() + piece.out, less);
+        });
+        std::swap(src, dst);
+        bounds = std::move(newBounds);
+    }
+    if (src != &data) {
+        data.swap(buffer);
+    }
+}
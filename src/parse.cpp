@@ -32,23 +32,16 @@ std::vector<std::string_view> split(
 {
     std::vector<std::string_view> parts;
     std::string_view remaining = str;
-    while (remaining.size() > 0 && (maxParts == 0 || parts.size() < maxParts)) {
+    // The last part gets the rest of the string, including any further delimiters
+    while (maxParts == 0 || parts.size() + 1 < maxParts) {
         const auto pos = remaining.find(delim);
         if (pos == std::string_view::npos) {
             break;
         }
         parts.emplace_back(remaining.substr(0, pos));
-        remaining = remaining.substr(pos + 1);
-    }
-    if (remaining.size() > 0) {
-        if (parts.size() < maxParts) {
-            parts.push_back(remaining);
-        } else {
-            // Append to last element (very hacky)
-            const auto offset = parts.back().data() - str.data();
-            parts.back() = str.substr(offset);
-        }
+        remaining = remaining.substr(pos + delim.size());
     }
+    parts.push_back(remaining);
     return parts;
 }
 
@@ -56,6 +49,9 @@ std::string_view trim(std::string_view str)
 {
     static constexpr auto spaces = " \f\n\r\t\v";
     const auto start = str.find_first_not_of(spaces);
+    if (start == std::string_view::npos) {
+        return {};
+    }
     const auto end = str.find_last_not_of(spaces);
     return str.substr(start, end - start + 1);
 }
@@ -113,6 +109,10 @@ int parse(int argc, char** argv)
                     values.push_back(std::string(part));
                 }
             }
+            // Lines with fewer fields than columns get empty strings for the missing ones
+            while (values.size() < columns.size()) {
+                values.push_back(std::string());
+            }
             return values;
         };
     } else {
@@ -132,12 +132,10 @@ int parse(int argc, char** argv)
                 lineBuffer.clear();
             } else {
                 output.row(parseLine(readView.substr(0, delimPos)));
-                readView = readView.substr(delimPos + 1);
             }
+            readView = readView.substr(delimPos + args.rowDelim->size());
         }
-        if (readView.size() > 0) {
-            lineBuffer.assign(readView);
-        }
+        lineBuffer.append(readView);
     }
 
     return 0;
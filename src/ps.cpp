@@ -10,6 +10,7 @@
 
 #include <clipp/clipp.hpp>
 
+#include "expr.hpp"
 #include "io.hpp"
 #include "util.hpp"
 
@@ -17,11 +18,28 @@ namespace {
 struct PsArgs : clipp::ArgsBase {
     bool verbose = false;
     bool all = false;
+    std::optional<std::string> where;
+    std::optional<std::string> columns;
 
     void args()
     {
         flag(verbose, "verbose", 'v').help("Display all columns.");
         flag(all, "all", 'a').help("Display processes of all users.");
+        flag(where, "where", 'w')
+            .help("Only display processes that match this jfilter expression. user and pid are "
+                  "checked before anything is read from /proc/<pid>/.");
+        flag(columns, "columns", 'c')
+            .help("Only display these columns (comma separated). Files that none of them (or "
+                  "--where) need are not read.");
+    }
+
+    std::string description() const override
+    {
+        return R"(
+jps -a --where 'user == postgres'
+jps --where 'pid > 1000 and cmdline contains python'
+jps -a --columns pid,rss
+)";
     }
 };
 
@@ -263,7 +281,18 @@ int ps(int argc, char** argv)
         columns.insert(columns.end(), moreColumns.begin(), moreColumns.end());
     }
 
-    Output output(columns);
+    Filter where(args.where.value_or(""), columns);
+    Projection projection(columns, args.columns);
+    projection.use(where.usedColumns());
+    const auto needUser = projection.needs("user");
+    const auto needStat = projection.needs("ppid") || projection.needs("state")
+        || projection.needs("cpuusage") || projection.needs("memusage")
+        || projection.needs("vsize") || projection.needs("rss") || projection.needs("starttime")
+        || projection.needs("cputime");
+    const auto needStartTime = projection.needs("starttime");
+    const auto needCmdLine = projection.needs("cmdline");
+
+    Output output(projection.columns());
 
     std::unordered_map<uid_t, std::string> usernames;
     const auto uid = ::getuid();
@@ -278,12 +307,12 @@ int ps(int argc, char** argv)
     const auto clockTicksHz = ::sysconf(_SC_CLK_TCK);
     assert(clockTicksHz > 0);
 
-    const auto bootTime = getBootTime();
+    const auto bootTime = needStat ? getBootTime() : 0;
     if (!bootTime) {
         return 3;
     }
 
-    const auto memTotal = getMemTotal();
+    const auto memTotal = needStat ? getMemTotal() : 0;
     if (!memTotal) {
         return 3;
     }
@@ -313,61 +342,90 @@ int ps(int argc, char** argv)
             continue;
         }
 
-        auto it = usernames.find(st.st_uid);
-        if (it == usernames.end()) {
-            const auto user = ::getpwuid(st.st_uid);
-            assert(user);
-            it = usernames.emplace(st.st_uid, user->pw_name).first;
+        // The columns are computed in order and the row is dropped as soon as it can't match.
+        // Columns that are not needed are left empty, nothing looks at them.
+        std::vector<Value> values { std::string(), static_cast<int64_t>(pid) };
+        if (needUser) {
+            auto it = usernames.find(st.st_uid);
+            if (it == usernames.end()) {
+                const auto user = ::getpwuid(st.st_uid);
+                assert(user);
+                it = usernames.emplace(st.st_uid, user->pw_name).first;
+            }
+            values[0] = it->second;
         }
-        const auto& username = it->second;
-
-        const auto procStat = readProcStat(procStatPath);
-        if (!procStat) {
+        if (where.rejects(values)) {
             continue;
         }
 
-        const int64_t startTimestamp = *bootTime + procStat->starttime / clockTicksHz;
-        const auto tm = std::localtime(&startTimestamp);
-        char timebuf[32];
-        if (std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", tm) == 0) {
-            std::cerr << "Cannot format timestamp " << startTimestamp << std::endl;
-            return 4;
+        if (needStat) {
+            const auto procStat = readProcStat(procStatPath);
+            if (!procStat) {
+                continue;
+            }
+
+            const int64_t startTimestamp = *bootTime + procStat->starttime / clockTicksHz;
+            std::string startTime;
+            if (needStartTime) {
+                const auto tm = std::localtime(&startTimestamp);
+                char timebuf[32];
+                if (std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", tm) == 0) {
+                    std::cerr << "Cannot format timestamp " << startTimestamp << std::endl;
+                    return 4;
+                }
+                startTime = timebuf;
+            }
+
+            const auto cpuTime = (procStat->utime + procStat->stime) / clockTicksHz;
+
+            const auto now = static_cast<int64_t>(std::time(nullptr));
+            const auto age = now - startTimestamp;
+            // This is what ps does, but I never really found it particularly useful.
+            const auto cpuUsage = age > 0 ? cpuTime * 100 / age : 0;
+            const auto memUsage = procStat->rss * pageSize * 100 / *memTotal;
+
+            values.insert(values.end(),
+                {
+                    static_cast<int64_t>(procStat->ppid),
+                    std::string(1, procStat->state),
+                    static_cast<int64_t>(cpuUsage),
+                    static_cast<int64_t>(memUsage),
+                    static_cast<int64_t>(procStat->vsize),
+                    static_cast<int64_t>(procStat->rss * pageSize),
+                    startTime,
+                    static_cast<int64_t>(cpuTime),
+                });
+            if (where.rejects(values)) {
+                continue;
+            }
+        } else {
+            // Everything up to cmdline
+            values.insert(values.end(),
+                {
+                    static_cast<int64_t>(0),
+                    std::string(),
+                    static_cast<int64_t>(0),
+                    static_cast<int64_t>(0),
+                    static_cast<int64_t>(0),
+                    static_cast<int64_t>(0),
+                    std::string(),
+                    static_cast<int64_t>(0),
+                });
         }
-        const std::string startTime(timebuf);
-
-        const auto cpuTime = (procStat->utime + procStat->stime) / clockTicksHz;
 
-        const auto now = static_cast<int64_t>(std::time(nullptr));
-        const auto age = now - startTimestamp;
-        // This is what ps does, but I never really found it particularly useful.
-        const auto cpuUsage = age > 0 ? cpuTime * 100 / age : 0;
-        const auto memUsage = procStat->rss * pageSize * 100 / *memTotal;
-
-        const auto cmdLinePath = procPath + "/cmdline";
-        const auto cmdLineFileData = readFile(cmdLinePath);
-        if (!cmdLineFileData) {
-            std::cerr << "Could not read " << cmdLinePath << std::endl;
-            continue;
-        }
-        const auto cmdLine = getCmdLine(cmdLinePath);
-        if (!cmdLine) {
-            continue;
+        if (needCmdLine) {
+            const auto cmdLine = getCmdLine(procPath + "/cmdline");
+            if (!cmdLine) {
+                continue;
+            }
+            values.push_back(*cmdLine);
+            if (where.rejects(values)) {
+                continue;
+            }
+        } else {
+            values.push_back(std::string());
         }
-
-        std::vector<Value> values {
-            username,
-            static_cast<int64_t>(procStat->pid),
-            static_cast<int64_t>(procStat->ppid),
-            std::string(1, procStat->state),
-            static_cast<int64_t>(cpuUsage),
-            static_cast<int64_t>(memUsage),
-            static_cast<int64_t>(procStat->vsize),
-            static_cast<int64_t>(procStat->rss * pageSize),
-            startTime,
-            static_cast<int64_t>(cpuTime),
-            *cmdLine,
-        };
-        output.row(values);
+        output.row(projection.apply(std::move(values)));
     }
     ::closedir(procDir);
 
@@ -0,0 +1,594 @@
+#include "regex.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+struct Regex::Node {
+    enum class Kind {
+        Bytes,
+        Begin,
+        End,
+        Concat,
+        Alternate,
+        Repeat,
+    };
+
+    Kind kind;
+    std::bitset<256> bytes;
+    std::vector<std::unique_ptr<Node>> children;
+    // For Repeat, max < 0 means unbounded
+    int min = 0;
+    int max = 0;
+};
+
+namespace {
+// Thrown for patterns that are left to std::regex
+struct Unsupported { };
+
+constexpr size_t MaxRepeat = 1000;
+constexpr size_t MaxProgramSize = 64 * 1024;
+// The DFA is thrown away and built again if it grows beyond this (256 transitions per state)
+constexpr size_t MaxStates = 2048;
+
+bool isWord(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+std::bitset<256> range(unsigned char first, unsigned char last)
+{
+    std::bitset<256> bytes;
+    for (size_t c = first; c <= last; ++c) {
+        bytes.set(c);
+    }
+    return bytes;
+}
+
+// The byte classes \d, \w and \s, complemented for \D, \W and \S
+std::optional<std::bitset<256>> classEscape(char c)
+{
+    std::bitset<256> bytes;
+    switch (c) {
+    case 'd':
+    case 'D':
+        bytes = range('0', '9');
+        break;
+    case 'w':
+    case 'W':
+        bytes = range('a', 'z') | range('A', 'Z') | range('0', '9');
+        bytes.set('_');
+        break;
+    case 's':
+    case 'S':
+        bytes = range('\t', '\r');
+        bytes.set(' ');
+        break;
+    default:
+        return std::nullopt;
+    }
+    if (c >= 'A' && c <= 'Z') {
+        bytes.flip();
+    }
+    return bytes;
+}
+}
+
+struct Regex::Parser {
+    using NodePtr = std::unique_ptr<Node>;
+
+    std::string_view pattern;
+    size_t pos = 0;
+
+    static NodePtr makeNode(Node::Kind kind)
+    {
+        auto node = std::make_unique<Node>();
+        node->kind = kind;
+        return node;
+    }
+
+    static NodePtr makeBytes(std::bitset<256> bytes)
+    {
+        auto node = makeNode(Node::Kind::Bytes);
+        node->bytes = bytes;
+        return node;
+    }
+
+    bool atEnd() const { return pos >= pattern.size(); }
+    char peek() const { return atEnd() ? '\0' : pattern[pos]; }
+
+    char next()
+    {
+        if (atEnd()) {
+            throw Unsupported {};
+        }
+        return pattern[pos++];
+    }
+
+    NodePtr parse()
+    {
+        auto node = parseAlternate();
+        if (!atEnd()) {
+            throw Unsupported {};
+        }
+        return node;
+    }
+
+    NodePtr parseAlternate()
+    {
+        auto node = parseConcat();
+        if (peek() != '|') {
+            return node;
+        }
+        auto alt = makeNode(Node::Kind::Alternate);
+        alt->children.push_back(std::move(node));
+        while (!atEnd() && peek() == '|') {
+            pos++;
+            alt->children.push_back(parseConcat());
+        }
+        return alt;
+    }
+
+    NodePtr parseConcat()
+    {
+        auto concat = makeNode(Node::Kind::Concat);
+        while (!atEnd() && peek() != '|' && peek() != ')') {
+            auto term = parseTerm();
+            if (term->kind == Node::Kind::Concat) {
+                // Groups are flattened, so literal prefixes inside them can be found
+                for (auto& child : term->children) {
+                    concat->children.push_back(std::move(child));
+                }
+            } else {
+                concat->children.push_back(std::move(term));
+            }
+        }
+        return concat;
+    }
+
+    NodePtr parseTerm()
+    {
+        if (peek() == '^' || peek() == '$') {
+            auto node = makeNode(next() == '^' ? Node::Kind::Begin : Node::Kind::End);
+            if (isQuantifier()) {
+                throw Unsupported {};
+            }
+            return node;
+        }
+        auto atom = parseAtom();
+        if (!isQuantifier()) {
+            return atom;
+        }
+        auto node = makeNode(Node::Kind::Repeat);
+        const auto c = next();
+        if (c == '*') {
+            node->min = 0;
+            node->max = -1;
+        } else if (c == '+') {
+            node->min = 1;
+            node->max = -1;
+        } else if (c == '?') {
+            node->min = 0;
+            node->max = 1;
+        } else {
+            node->min = parseCount();
+            node->max = node->min;
+            if (peek() == ',') {
+                pos++;
+                node->max = peek() == '}' ? -1 : parseCount();
+            }
+            if (next() != '}' || (node->max >= 0 && node->max < node->min)) {
+                throw Unsupported {};
+            }
+        }
+        // Laziness does not change whether there is a match
+        if (peek() == '?') {
+            pos++;
+        }
+        if (isQuantifier()) {
+            throw Unsupported {};
+        }
+        node->children.push_back(std::move(atom));
+        return node;
+    }
+
+    bool isQuantifier() const
+    {
+        return !atEnd() && std::strchr("*+?{", peek()) != nullptr;
+    }
+
+    int parseCount()
+    {
+        size_t count = 0;
+        size_t digits = 0;
+        while (peek() >= '0' && peek() <= '9') {
+            count = count * 10 + (next() - '0');
+            if (++digits > 4 || count > MaxRepeat) {
+                throw Unsupported {};
+            }
+        }
+        if (digits == 0) {
+            throw Unsupported {};
+        }
+        return static_cast<int>(count);
+    }
+
+    NodePtr parseAtom()
+    {
+        const auto c = next();
+        switch (c) {
+        case '(': {
+            if (peek() == '?') {
+                pos++;
+                // Only non-capturing groups, no lookahead
+                if (next() != ':') {
+                    throw Unsupported {};
+                }
+            }
+            auto node = parseAlternate();
+            if (next() != ')') {
+                throw Unsupported {};
+            }
+            return node;
+        }
+        case '.': {
+            std::bitset<256> bytes;
+            bytes.set();
+            bytes.reset('\n');
+            bytes.reset('\r');
+            return makeBytes(bytes);
+        }
+        case '[':
+            return makeBytes(parseClass());
+        case '\\': {
+            const auto e = next();
+            if (const auto bytes = classEscape(e)) {
+                return makeBytes(*bytes);
+            }
+            std::bitset<256> bytes;
+            bytes.set(static_cast<unsigned char>(parseEscape(e)));
+            return makeBytes(bytes);
+        }
+        case ')':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+        case '}':
+        case ']':
+            throw Unsupported {};
+        default: {
+            std::bitset<256> bytes;
+            bytes.set(static_cast<unsigned char>(c));
+            return makeBytes(bytes);
+        }
+        }
+    }
+
+    // The byte a character escape (after the backslash) stands for
+    char parseEscape(char e)
+    {
+        switch (e) {
+        case 'n':
+            return '\n';
+        case 't':
+            return '\t';
+        case 'r':
+            return '\r';
+        case 'f':
+            return '\f';
+        case 'v':
+            return '\v';
+        case '0':
+            if (peek() >= '0' && peek() <= '9') {
+                throw Unsupported {};
+            }
+            return '\0';
+        case 'x': {
+            int value = 0;
+            for (int i = 0; i < 2; ++i) {
+                const auto h = next();
+                const auto digit = std::string_view("0123456789abcdef").find(
+                    static_cast<char>(h >= 'A' && h <= 'F' ? h - 'A' + 'a' : h));
+                if (digit == std::string_view::npos) {
+                    throw Unsupported {};
+                }
+                value = value * 16 + static_cast<int>(digit);
+            }
+            return static_cast<char>(value);
+        }
+        default:
+            // Backreferences, word boundaries and other letters are not for us
+            if (isWord(e)) {
+                throw Unsupported {};
+            }
+            return e;
+        }
+    }
+
+    std::bitset<256> parseClass()
+    {
+        std::bitset<256> bytes;
+        const auto negate = peek() == '^';
+        if (negate) {
+            pos++;
+        }
+        // Empty classes and [] as the first member are read differently by different engines
+        if (peek() == ']') {
+            throw Unsupported {};
+        }
+        while (peek() != ']') {
+            const auto first = parseClassMember(bytes);
+            if (!first || peek() != '-' || pos + 1 >= pattern.size() || pattern[pos + 1] == ']') {
+                continue;
+            }
+            pos++;
+            std::bitset<256> unused;
+            const auto last = parseClassMember(unused);
+            // Ranges of non-ASCII bytes depend on the signedness of char
+            if (!last || *first > *last || *first < 0 || *last < 0) {
+                throw Unsupported {};
+            }
+            bytes |= range(static_cast<unsigned char>(*first), static_cast<unsigned char>(*last));
+        }
+        pos++;
+        if (negate) {
+            bytes.flip();
+        }
+        return bytes;
+    }
+
+    // Adds the next member of a class to `bytes`. Returns it if it is a single byte.
+    std::optional<char> parseClassMember(std::bitset<256>& bytes)
+    {
+        const auto c = next();
+        if (c == '[' && (peek() == ':' || peek() == '.' || peek() == '=')) {
+            throw Unsupported {};
+        }
+        if (c != '\\') {
+            bytes.set(static_cast<unsigned char>(c));
+            return c;
+        }
+        const auto e = next();
+        if (const auto escaped = classEscape(e)) {
+            bytes |= *escaped;
+            return std::nullopt;
+        }
+        const auto b = parseEscape(e);
+        bytes.set(static_cast<unsigned char>(b));
+        return b;
+    }
+};
+
+Regex::Regex(const std::string& pattern)
+{
+    std::unique_ptr<Node> root;
+    try {
+        root = Parser { pattern }.parse();
+        // Every match starts wherever the search does
+        if (!(root->kind == Node::Kind::Concat && !root->children.empty()
+                && root->children[0]->kind == Node::Kind::Begin)) {
+            program_.push_back(Instruction { Instruction::Type::Split, 3, 1, {} });
+            program_.push_back(Instruction { Instruction::Type::Bytes, 0, 0, {} });
+            program_.back().bytes.set();
+            program_.push_back(Instruction { Instruction::Type::Jump, 0, 0, {} });
+        }
+        emit(*root);
+        program_.push_back(Instruction { Instruction::Type::Match, 0, 0, {} });
+    } catch (const Unsupported&) {
+        fallback_.emplace(pattern);
+        return;
+    }
+
+    if (root->kind == Node::Kind::Concat) {
+        for (const auto& child : root->children) {
+            if (child->kind == Node::Kind::Begin && prefix_.empty() && !anchored_) {
+                anchored_ = true;
+            } else if (child->kind == Node::Kind::Bytes && child->bytes.count() == 1) {
+                for (size_t c = 0; c < 256; ++c) {
+                    if (child->bytes.test(c)) {
+                        prefix_.push_back(static_cast<char>(c));
+                    }
+                }
+            } else {
+                break;
+            }
+        }
+    }
+}
+
+void Regex::emit(const Node& node)
+{
+    using Type = Instruction::Type;
+    const auto here = [this]() { return static_cast<uint32_t>(program_.size()); };
+    switch (node.kind) {
+    case Node::Kind::Bytes:
+        program_.push_back(Instruction { Type::Bytes, 0, 0, node.bytes });
+        break;
+    case Node::Kind::Begin:
+        program_.push_back(Instruction { Type::AssertBegin, 0, 0, {} });
+        break;
+    case Node::Kind::End:
+        program_.push_back(Instruction { Type::AssertEnd, 0, 0, {} });
+        break;
+    case Node::Kind::Concat:
+        for (const auto& child : node.children) {
+            emit(*child);
+        }
+        break;
+    case Node::Kind::Alternate: {
+        std::vector<uint32_t> jumps;
+        for (size_t i = 0; i < node.children.size(); ++i) {
+            if (i + 1 == node.children.size()) {
+                emit(*node.children[i]);
+                break;
+            }
+            const auto split = here();
+            program_.push_back(Instruction { Type::Split, split + 1, 0, {} });
+            emit(*node.children[i]);
+            jumps.push_back(here());
+            program_.push_back(Instruction { Type::Jump, 0, 0, {} });
+            program_[split].y = here();
+        }
+        for (const auto jump : jumps) {
+            program_[jump].x = here();
+        }
+        break;
+    }
+    case Node::Kind::Repeat: {
+        const auto& child = *node.children[0];
+        for (int i = 0; i < node.min; ++i) {
+            emit(child);
+        }
+        if (node.max < 0) {
+            const auto loop = here();
+            program_.push_back(Instruction { Type::Split, loop + 1, 0, {} });
+            emit(child);
+            program_.push_back(Instruction { Type::Jump, loop, 0, {} });
+            program_[loop].y = here();
+        } else {
+            std::vector<uint32_t> splits;
+            for (int i = node.min; i < node.max; ++i) {
+                splits.push_back(here());
+                program_.push_back(Instruction { Type::Split, here() + 1, 0, {} });
+                emit(child);
+            }
+            for (const auto split : splits) {
+                program_[split].y = here();
+            }
+        }
+        break;
+    }
+    }
+    if (program_.size() > MaxProgramSize) {
+        throw Unsupported {};
+    }
+}
+
+std::vector<uint32_t> Regex::closure(
+    const std::vector<uint32_t>& pcs, bool atBegin, bool atEnd) const
+{
+    using Type = Instruction::Type;
+    std::vector<uint32_t> set;
+    std::vector<uint8_t> visited(program_.size());
+    std::vector<uint32_t> stack(pcs.rbegin(), pcs.rend());
+    while (!stack.empty()) {
+        const auto pc = stack.back();
+        stack.pop_back();
+        if (visited[pc]) {
+            continue;
+        }
+        visited[pc] = 1;
+        const auto& ins = program_[pc];
+        switch (ins.type) {
+        case Type::Bytes:
+        case Type::Match:
+            set.push_back(pc);
+            break;
+        case Type::Split:
+            stack.push_back(ins.y);
+            stack.push_back(ins.x);
+            break;
+        case Type::Jump:
+            stack.push_back(ins.x);
+            break;
+        case Type::AssertBegin:
+            if (atBegin) {
+                stack.push_back(pc + 1);
+            }
+            break;
+        case Type::AssertEnd:
+            if (atEnd) {
+                stack.push_back(pc + 1);
+            } else {
+                set.push_back(pc);
+            }
+            break;
+        }
+    }
+    std::sort(set.begin(), set.end());
+    return set;
+}
+
+int32_t Regex::addState(std::vector<uint32_t> nfa, bool atBegin)
+{
+    const auto isMatch = [this](const std::vector<uint32_t>& set) {
+        return std::any_of(set.begin(), set.end(),
+            [this](uint32_t pc) { return program_[pc].type == Instruction::Type::Match; });
+    };
+
+    auto key = nfa;
+    if (atBegin) {
+        // The same NFA states might continue differently at the beginning of the input
+        key.push_back(UINT32_MAX);
+    }
+    const auto it = stateIds_.find(key);
+    if (it != stateIds_.end()) {
+        return it->second;
+    }
+    const auto id = static_cast<int32_t>(states_.size());
+    State state;
+    state.match = isMatch(nfa);
+    state.matchAtEnd = isMatch(closure(nfa, atBegin, true));
+    state.stop = state.match || nfa.empty();
+    state.nfa = std::move(nfa);
+    states_.push_back(std::move(state));
+    stateIds_.emplace(std::move(key), id);
+    transitions_.resize(states_.size() * 256, -1);
+    return id;
+}
+
+int32_t Regex::step(int32_t state, uint8_t byte)
+{
+    std::vector<uint32_t> pcs;
+    for (const auto pc : states_[state].nfa) {
+        const auto& ins = program_[pc];
+        if (ins.type == Instruction::Type::Bytes && ins.bytes.test(byte)) {
+            pcs.push_back(pc + 1);
+        }
+    }
+    auto nfa = closure(pcs, false, false);
+    if (states_.size() >= MaxStates) {
+        states_.clear();
+        stateIds_.clear();
+        transitions_.clear();
+        beginState_ = -1;
+        startState_ = -1;
+        return addState(std::move(nfa), false);
+    }
+    const auto next = addState(std::move(nfa), false);
+    transitions_[static_cast<size_t>(state) * 256 + byte] = next;
+    return next;
+}
+
+bool Regex::search(std::string_view str)
+{
+    if (fallback_) {
+        return std::regex_search(str.begin(), str.end(), *fallback_);
+    }
+
+    size_t pos = 0;
+    if (anchored_) {
+        if (str.substr(0, prefix_.size()) != prefix_) {
+            return false;
+        }
+    } else if (!prefix_.empty()) {
+        const auto found = memmem(str.data(), str.size(), prefix_.data(), prefix_.size());
+        if (!found) {
+            return false;
+        }
+        pos = static_cast<size_t>(static_cast<const char*>(found) - str.data());
+    }
+
+    if (beginState_ < 0) {
+        beginState_ = addState(closure({ 0 }, true, false), true);
+        startState_ = addState(closure({ 0 }, false, false), false);
+    }
+    auto state = pos == 0 ? beginState_ : startState_;
+    for (; pos < str.size() && !states_[state].stop; ++pos) {
+        const auto byte = static_cast<uint8_t>(str[pos]);
+        const auto next = transitions_[static_cast<size_t>(state) * 256 + byte];
+        state = next >= 0 ? next : step(state, byte);
+    }
+    return states_[state].match || (pos == str.size() && states_[state].matchAtEnd);
+}
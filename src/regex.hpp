@@ -0,0 +1,76 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A regular expression search that takes linear time and constant stack space. The pattern is
+// compiled into a Thompson NFA, which is turned into a DFA lazily: DFA states (sets of NFA states)
+// and their transitions are only built when the input reaches them.
+// Patterns are interpreted like std::regex does by default (ECMAScript), byte by byte. The few
+// features that an automaton can not express (backreferences, lookahead, word boundaries) and
+// anything unusual are handed to std::regex instead.
+// If every match has to start with a literal string, memmem skips ahead to it (or rejects the
+// input right away) before the automaton runs.
+class Regex {
+public:
+    // Throws std::regex_error if the pattern is invalid
+    explicit Regex(const std::string& pattern);
+
+    // Whether the pattern matches any part of `str`
+    bool search(std::string_view str);
+
+private:
+    struct Node;
+    struct Parser;
+
+    struct Instruction {
+        enum class Type {
+            Bytes,
+            Split,
+            Jump,
+            AssertBegin,
+            AssertEnd,
+            Match,
+        };
+
+        Type type;
+        // The targets of Split and Jump
+        uint32_t x = 0;
+        uint32_t y = 0;
+        // The bytes accepted by Bytes
+        std::bitset<256> bytes;
+    };
+
+    struct State {
+        // The NFA instructions that consume a byte, match or wait for the end of the input
+        std::vector<uint32_t> nfa;
+        bool match;
+        bool matchAtEnd;
+        // Nothing that comes after can change the result (it matches or can't match anymore)
+        bool stop;
+    };
+
+    void emit(const Node& node);
+    // `pcs` and everything that is reachable from them without consuming a byte
+    std::vector<uint32_t> closure(const std::vector<uint32_t>& pcs, bool atBegin, bool atEnd) const;
+    int32_t addState(std::vector<uint32_t> nfa, bool atBegin);
+    int32_t step(int32_t state, uint8_t byte);
+
+    std::optional<std::regex> fallback_;
+    std::string prefix_;
+    bool anchored_ = false;
+
+    std::vector<Instruction> program_;
+    std::vector<State> states_;
+    std::map<std::vector<uint32_t>, int32_t> stateIds_;
+    // 256 transitions per state, -1 if not built yet
+    std::vector<int32_t> transitions_;
+    int32_t beginState_ = -1;
+    int32_t startState_ = -1;
+};
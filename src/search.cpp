@@ -0,0 +1,238 @@
+#include "search.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JUTILS_X86 1
+#endif
+
+namespace {
+#ifdef JUTILS_X86
+// These need at least one vector worth of starting positions (haystack.size() - needle.size() + 1).
+// The last vector overlaps the one before it instead of testing the rest one by one.
+__attribute__((target("avx2"))) bool containsAvx2(
+    std::string_view haystack, std::string_view needle)
+{
+    const auto n = needle.size();
+    const auto first = _mm256_set1_epi8(needle.front());
+    const auto last = _mm256_set1_epi8(needle.back());
+    const auto test = [&](size_t pos) __attribute__((target("avx2"))) {
+        const auto blockFirst
+            = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack.data() + pos));
+        const auto blockLast
+            = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack.data() + pos + n - 1));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last))));
+        while (mask) {
+            const auto candidate = haystack.data() + pos + __builtin_ctz(mask);
+            if (std::memcmp(candidate + 1, needle.data() + 1, n - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+        return false;
+    };
+    const auto positions = haystack.size() - n + 1;
+    size_t pos = 0;
+    for (; pos + 32 <= positions; pos += 32) {
+        if (test(pos)) {
+            return true;
+        }
+    }
+    return pos < positions && test(positions - 32);
+}
+
+bool containsSse2(std::string_view haystack, std::string_view needle)
+{
+    const auto n = needle.size();
+    const auto first = _mm_set1_epi8(needle.front());
+    const auto last = _mm_set1_epi8(needle.back());
+    const auto test = [&](size_t pos) {
+        const auto blockFirst
+            = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + pos));
+        const auto blockLast
+            = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + pos + n - 1));
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last))));
+        while (mask) {
+            const auto candidate = haystack.data() + pos + __builtin_ctz(mask);
+            if (std::memcmp(candidate + 1, needle.data() + 1, n - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+        return false;
+    };
+    const auto positions = haystack.size() - n + 1;
+    size_t pos = 0;
+    for (; pos + 16 <= positions; pos += 16) {
+        if (test(pos)) {
+            return true;
+        }
+    }
+    return pos < positions && test(positions - 16);
+}
+#endif
+}
+
+SubstringSearch::SubstringSearch(std::string needle)
+    : needle_(std::move(needle))
+{
+}
+
+bool SubstringSearch::in(std::string_view haystack) const
+{
+    if (needle_.size() <= 1) {
+        return needle_.empty() || haystack.find(needle_[0]) != std::string_view::npos;
+    }
+    if (haystack.size() < needle_.size()) {
+        return false;
+    }
+#ifdef JUTILS_X86
+    static const auto avx2 = __builtin_cpu_supports("avx2");
+    const auto positions = haystack.size() - needle_.size() + 1;
+    if (avx2 && positions >= 32) {
+        return containsAvx2(haystack, needle_);
+    }
+    if (positions >= 16) {
+        return containsSse2(haystack, needle_);
+    }
+#endif
+    return haystack.find(needle_) != std::string_view::npos;
+}
+
+MultiSubstringSearch::MultiSubstringSearch(const std::vector<std::string>& needles)
+{
+    if (needles.size() <= MaxSeparateNeedles) {
+        for (const auto& needle : needles) {
+            separate_.emplace_back(needle);
+        }
+        return;
+    }
+
+    for (const auto& needle : needles) {
+        for (const auto c : needle) {
+            auto& cls = classes_[static_cast<uint8_t>(c)];
+            if (!cls) {
+                cls = static_cast<uint16_t>(numClasses_++);
+            }
+        }
+    }
+
+    // Build a trie first (0 means there is no child, since the root can't be one)
+    std::vector<uint32_t> trie(numClasses_, 0);
+    outputs_.emplace_back();
+    for (const auto& needle : needles) {
+        uint32_t state = 0;
+        for (const auto c : needle) {
+            const auto idx = state * numClasses_ + classes_[static_cast<uint8_t>(c)];
+            if (!trie[idx]) {
+                trie[idx] = static_cast<uint32_t>(outputs_.size());
+                trie.resize(trie.size() + numClasses_, 0);
+                outputs_.emplace_back();
+            }
+            state = trie[idx];
+        }
+        // Duplicates count once
+        if (outputs_[state].empty()) {
+            outputs_[state].push_back(static_cast<uint32_t>(numNeedles_++));
+        }
+    }
+
+    // Then turn it into an automaton: Bytes that don't continue a needle continue the longest
+    // suffix of what was read so far that is a prefix of a needle instead.
+    std::vector<uint32_t> fallback(outputs_.size(), 0);
+    std::queue<uint32_t> queue;
+    for (size_t cls = 0; cls < numClasses_; ++cls) {
+        if (trie[cls]) {
+            queue.push(trie[cls]);
+        }
+    }
+    while (!queue.empty()) {
+        const auto state = queue.front();
+        queue.pop();
+        // The fallback is closer to the root, so its outputs are complete already
+        const auto& inherited = outputs_[fallback[state]];
+        outputs_[state].insert(outputs_[state].end(), inherited.begin(), inherited.end());
+        for (size_t cls = 0; cls < numClasses_; ++cls) {
+            auto& next = trie[state * numClasses_ + cls];
+            const auto alternative = trie[fallback[state] * numClasses_ + cls];
+            if (next) {
+                fallback[next] = alternative;
+                queue.push(next);
+            } else {
+                next = alternative;
+            }
+        }
+    }
+
+    transitions_.resize(trie.size());
+    for (size_t i = 0; i < trie.size(); ++i) {
+        transitions_[i] = static_cast<uint32_t>(trie[i] * numClasses_)
+            | (outputs_[trie[i]].empty() ? 0 : OutputFlag);
+    }
+    found_.resize(numNeedles_);
+}
+
+bool MultiSubstringSearch::any(std::string_view haystack) const
+{
+    if (!separate_.empty()) {
+        for (const auto& search : separate_) {
+            if (search.in(haystack)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (!outputs_[0].empty()) {
+        return true;
+    }
+    uint32_t state = 0;
+    for (const auto c : haystack) {
+        state = transitions_[state + classes_[static_cast<uint8_t>(c)]];
+        if (state & OutputFlag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MultiSubstringSearch::all(std::string_view haystack)
+{
+    if (!separate_.empty()) {
+        for (const auto& search : separate_) {
+            if (!search.in(haystack)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    std::fill(found_.begin(), found_.end(), 0);
+    size_t numFound = 0;
+    const auto visit = [&](size_t state) {
+        for (const auto needle : outputs_[state]) {
+            if (!found_[needle]) {
+                found_[needle] = 1;
+                numFound++;
+            }
+        }
+        return numFound == numNeedles_;
+    };
+    if (visit(0)) {
+        return true;
+    }
+    uint32_t state = 0;
+    for (const auto c : haystack) {
+        state = transitions_[state + classes_[static_cast<uint8_t>(c)]];
+        if (state & OutputFlag) {
+            state &= ~OutputFlag;
+            if (visit(state / numClasses_)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Looks for a fixed string. Candidate positions are found by comparing the first and the last
+// byte of the needle to 32 (AVX2) or 16 (SSE2) positions at once and only those are compared in
+// full.
+class SubstringSearch {
+public:
+    explicit SubstringSearch(std::string needle);
+
+    bool in(std::string_view haystack) const;
+
+private:
+    std::string needle_;
+};
+
+// Looks for many fixed strings at once with an Aho-Corasick automaton, so every byte of the
+// haystack is only looked at once, no matter how many needles there are. A few needles are
+// faster to look for one after the other with SubstringSearch though.
+class MultiSubstringSearch {
+public:
+    explicit MultiSubstringSearch(const std::vector<std::string>& needles);
+
+    // Whether at least one of the needles is in `haystack`
+    bool any(std::string_view haystack) const;
+    // Whether all of the needles are in `haystack`
+    bool all(std::string_view haystack);
+
+private:
+    static constexpr size_t MaxSeparateNeedles = 12;
+    // Set in transitions to states in which at least one needle ends
+    static constexpr uint32_t OutputFlag = 1u << 31;
+
+    std::vector<SubstringSearch> separate_;
+    // Bytes that don't appear in any needle share a class, so the transition table stays small
+    uint16_t classes_[256] = {};
+    size_t numClasses_ = 1;
+    // numClasses_ transitions per state, state 0 is the root. States are stored as the index of
+    // their first transition.
+    std::vector<uint32_t> transitions_;
+    // The needles that end in a state (including those that are suffixes of others)
+    std::vector<std::vector<uint32_t>> outputs_;
+    size_t numNeedles_ = 0;
+    // For all(): The needles found so far
+    std::vector<uint8_t> found_;
+};
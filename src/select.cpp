@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #include <clipp/clipp.hpp>
@@ -35,14 +36,28 @@ int select(int argc, char** argv)
         columns.push_back(input.columns()[idx]);
     }
 
-    Output output(columns);
-
-    while (const auto row = input.row()) {
-        std::vector<Value> values;
-        for (const auto& idx : columnIndices) {
-            values.push_back(row.value()[idx]);
+    // The rows are still sorted by the keys up to the first one that is not selected
+    std::vector<SortKey> sortedBy;
+    for (const auto& key : input.sortedBy()) {
+        const auto it = std::find(columnIndices.begin(), columnIndices.end(), key.column);
+        if (it == columnIndices.end()) {
+            break;
         }
-        output.row(values);
+        const auto column = static_cast<size_t>(it - columnIndices.begin());
+        sortedBy.push_back(SortKey { column, key.descending });
+    }
+
+    Output output(columns, sortedBy);
+
+    std::vector<bool> neededColumns(input.columns().size(), false);
+    for (const auto idx : columnIndices) {
+        neededColumns[idx] = true;
+    }
+    input.needColumns(std::move(neededColumns));
+    output.passthrough(input, columnIndices);
+
+    while (const auto row = input.rowView()) {
+        output.row(*row, columnIndices);
     }
 
     return 0;
@@ -45,32 +45,75 @@ int slice(int argc, char** argv)
     }
 
     Input input;
+    // Taking rows in reverse order reverses the direction they are sorted in
+    auto sortedBy = input.sortedBy();
+    if (step < 0) {
+        for (auto& key : sortedBy) {
+            key.descending = !key.descending;
+        }
+    }
+    Output output(input.columns(), sortedBy);
+
+    auto num = args.num;
+
+    // Without negative values we know where to start and stop without knowing the number of rows,
+    // so we can pass the rows through as they come.
+    const auto streaming = step > 0 && args.offset.value_or(0) >= 0 && num.value_or(0) >= 0;
+    if (streaming) {
+        output.passthrough(input);
+        const auto offset = args.offset.value_or(0);
+        int64_t index = 0;
+        int64_t numOutput = 0;
+        while (!(num && numOutput >= *num)) {
+            if (index >= offset && step == 1 && !num) {
+                // Everything from here on is output
+                output.copyRest(input);
+                break;
+            }
+            const auto row = input.rowView();
+            if (!row) {
+                break;
+            }
+            if (index >= offset && (index - offset) % step == 0) {
+                output.row(*row);
+                numOutput++;
+            }
+            index++;
+        }
+        return 0;
+    }
 
-    // For now this will sponge every time, because it's easier to do
-    std::vector<std::vector<Value>> rows = input.rows();
+    // If the input is a file, we only need to remember where the rows are
+    RowArena rows(input.columns());
+    std::vector<RowLocation> locations;
+    while (const auto row = input.rowView()) {
+        if (input.seekable()) {
+            locations.push_back(input.location());
+        } else {
+            rows.push(*row);
+        }
+    }
+    const auto numRows = static_cast<int64_t>(input.seekable() ? locations.size() : rows.size());
 
-    auto offset = [&]() {
+    const auto offset = [&]() -> int64_t {
         if (args.offset) {
-            return *args.offset >= 0 ? *args.offset : rows.size() + *args.offset;
+            return *args.offset >= 0 ? *args.offset : numRows + *args.offset;
         } else {
-            return step > 0 ? 0 : rows.size() - 1;
+            return step > 0 ? 0 : numRows - 1;
         }
     }();
 
-    auto num = args.num;
     if (num && *num < 0) {
-        num = rows.size() + *num;
+        num = numRows + *num;
     }
 
-    Output output(input.columns());
-
     int64_t numOutput = 0;
-    for (int64_t i = offset; i >= 0 && i < static_cast<int64_t>(rows.size()); i += step) {
-        output.row(rows[i]);
-        numOutput++;
+    for (int64_t i = offset; i >= 0 && i < numRows; i += step) {
         if (num && numOutput >= *num) {
             break;
         }
+        output.row(input.seekable() ? input.rowAt(locations[i]) : rows[i]);
+        numOutput++;
     }
 
     return 0;
@@ -1,61 +1,596 @@
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <queue>
+#include <unordered_map>
 
 #include <clipp/clipp.hpp>
 
 #include "io.hpp"
+#include "parallel.hpp"
 #include "util.hpp"
 
 namespace {
 struct SortArgs : clipp::ArgsBase {
     bool reverse = false;
-    std::string column;
+    std::optional<std::string> memoryLimit;
+    std::optional<int64_t> threads = 1;
+    std::optional<int64_t> limit;
 
     void args()
     {
-        flag(reverse, "reverse", 'r');
-        positional(column, "column");
+        flag(reverse, "reverse", 'r').help("Reverse the direction of all keys.");
+        flag(memoryLimit, "memory-limit", 'm')
+            .help("Sort runs of at most this size (e.g. 512M or 4G) in memory, write them to "
+                  "$TMPDIR and merge them.");
+        flag(threads, "threads", 't').help("Sort with this many threads. 0 uses all cores.");
+        flag(limit, "limit", 'l')
+            .help("Only output the first n rows. Only these rows are kept in memory.");
+    }
+
+    std::string description() const override
+    {
+        return R"(
+Sorts by one or more key columns. Prefix a column with '-' to sort by it in descending order.
+
+jsort pid # by pid
+jsort -rss # by rss, largest first
+jsort user -rss # by user, then by rss, largest first
+jsort -l 20 -rss # the 20 rows with the largest rss
+)";
     }
 };
 
-bool compare(const Value& a, const Value& b)
+// Separates the key columns from the flags, so that "-rss" is a key and not "-r -s -s".
+// An argument starting with '-' is only a flag if it's a long option or a group of short options
+// that all exist (-r, -h and a final -m, -t or -l, which take the next argument as their value).
+std::vector<std::string> extractKeys(
+    int argc, char** argv, std::vector<std::pair<std::string, bool>>& keys)
+{
+    std::vector<std::string> flags;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg.size() > 2 && arg.substr(0, 2) == "--") {
+            flags.emplace_back(arg);
+            if ((arg == "--memory-limit" || arg == "--threads" || arg == "--limit")
+                && i + 1 < argc) {
+                flags.emplace_back(argv[++i]);
+            }
+            continue;
+        }
+        if (arg.size() < 2 || arg[0] != '-') {
+            keys.emplace_back(std::string(arg), false);
+            continue;
+        }
+        const auto last = arg.find_first_not_of("rh", 1);
+        if (last == std::string_view::npos) {
+            flags.emplace_back(arg);
+        } else if (last == arg.size() - 1
+            && (arg[last] == 'm' || arg[last] == 't' || arg[last] == 'l')) {
+            flags.emplace_back(arg);
+            if (i + 1 < argc) {
+                flags.emplace_back(argv[++i]);
+            }
+        } else {
+            keys.emplace_back(std::string(arg.substr(1)), true);
+        }
+    }
+    return flags;
+}
+
+// Keys are encoded so that comparing the bytes with memcmp gives the order of the rows:
+// Integers are stored big endian with the sign bit flipped. Strings are terminated by "\0\0"
+// and contain "\0\xff" for every zero byte, so a string sorts before all its extensions.
+// For descending keys all bits are inverted.
+void appendKey(std::string& out, int64_t value, bool descending)
+{
+    auto v = static_cast<uint64_t>(value) ^ (uint64_t(1) << 63);
+    if (descending) {
+        v = ~v;
+    }
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>(v >> shift));
+    }
+}
+
+void appendKey(std::string& out, std::string_view value, bool descending)
 {
-    assert(a.index() == b.index());
-    if (a.index() == 0) {
-        return std::get<0>(a) < std::get<0>(b);
-    } else if (a.index() == 1) {
-        return std::get<1>(a) < std::get<1>(b);
-    } else {
-        std::abort();
+    const char flip = descending ? '\xff' : 0;
+    for (const auto c : value) {
+        out.push_back(c ^ flip);
+        if (c == 0) {
+            out.push_back('\xff' ^ flip);
+        }
+    }
+    out.push_back(flip);
+    out.push_back(flip);
+}
+
+void appendKey(std::string& out, const RowView& row, const std::vector<SortKey>& keys)
+{
+    for (const auto& key : keys) {
+        if (row.columns()[key.column].type == Column::Type::I64) {
+            appendKey(out, row.i64(key.column), key.descending);
+        } else {
+            appendKey(out, row.str(key.column), key.descending);
+        }
+    }
+}
+
+int compareKeys(std::string_view a, std::string_view b)
+{
+    const auto res = std::memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+    if (res != 0) {
+        return res;
+    }
+    return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+// Returns the indices of the keys in sorted order. Equal keys keep their order.
+std::vector<size_t> keyOrder(
+    const std::string& bytes, const std::vector<size_t>& offsets, size_t threads)
+{
+    // The first 8 bytes of each key are kept next to the index as an integer, so most comparisons
+    // don't have to look at the key bytes at all.
+    struct Entry {
+        uint64_t prefix;
+        size_t index;
+    };
+    std::vector<Entry> entries(offsets.size() - 1);
+    auto key = [&](size_t idx) {
+        return std::string_view(bytes).substr(offsets[idx], offsets[idx + 1] - offsets[idx]);
+    };
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const auto k = key(i);
+        uint64_t prefix = 0;
+        for (size_t b = 0; b < 8; ++b) {
+            prefix = (prefix << 8) | (b < k.size() ? static_cast<uint8_t>(k[b]) : 0);
+        }
+        entries[i] = Entry { prefix, i };
+    }
+
+    parallelStableSort(
+        entries,
+        [&](const Entry& a, const Entry& b) {
+            if (a.prefix != b.prefix) {
+                return a.prefix < b.prefix;
+            }
+            return compareKeys(key(a.index), key(b.index)) < 0;
+        },
+        threads);
+
+    std::vector<size_t> order(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        order[i] = entries[i].index;
+    }
+    return order;
+}
+
+// Stable LSD radix sort of the keys, returns the indices of the keys in sorted order
+std::vector<size_t> radixSortOrder(const std::vector<uint64_t>& keys)
+{
+    struct Entry {
+        uint64_t key;
+        size_t index;
+    };
+    std::vector<Entry> entries(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        entries[i] = Entry { keys[i], i };
+    }
+    std::vector<Entry> buffer(keys.size());
+
+    constexpr size_t Bits = 8;
+    constexpr size_t Buckets = 1 << Bits;
+    for (size_t shift = 0; shift < 64; shift += Bits) {
+        size_t counts[Buckets] = {};
+        for (const auto& entry : entries) {
+            counts[(entry.key >> shift) & (Buckets - 1)]++;
+        }
+        // Skip digits that are the same for every key (e.g. the high bytes of small values)
+        if (counts[(entries.front().key >> shift) & (Buckets - 1)] == entries.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for (auto& count : counts) {
+            const auto n = count;
+            count = offset;
+            offset += n;
+        }
+        for (const auto& entry : entries) {
+            buffer[counts[(entry.key >> shift) & (Buckets - 1)]++] = entry;
+        }
+        entries.swap(buffer);
+    }
+
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        order[i] = entries[i].index;
+    }
+    return order;
+}
+
+// Rows that are sorted in memory. Only the sort keys are kept in a form that is convenient for
+// sorting. The rows themselves stay encoded (in an arena or in the mapped input) until they are
+// output in sorted order.
+class Chunk {
+public:
+    Chunk(Input& input, std::vector<SortKey> keys)
+        : input_(input)
+        , keys_(std::move(keys))
+        , rows_(input.columns())
+        // Version 2 rows would need their whole block decoded for every access
+        , useLocations_(input.seekable() && input.version() == 1)
+        , singleIntKey_(
+              keys_.size() == 1 && input.columns()[keys_[0].column].type == Column::Type::I64)
+        , useRanks_(
+              keys_.size() == 1 && input.columns()[keys_[0].column].type == Column::Type::String)
+    {
+    }
+
+    void push(const RowView& row)
+    {
+        if (useLocations_) {
+            locations_.push_back(input_.location());
+        } else {
+            rows_.push(row);
+        }
+        size_++;
+
+        if (singleIntKey_) {
+            intKeys_.push_back(row.i64(keys_[0].column));
+        } else if (useRanks_) {
+            pushRank(row);
+        } else {
+            appendKey(keyBytes_, row, keys_);
+            keyOffsets_.push_back(keyBytes_.size());
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    // Roughly the memory used by the chunk
+    size_t byteSize() const
+    {
+        return rows_.byteSize() + rows_.size() * sizeof(size_t)
+            + locations_.size() * sizeof(RowLocation) + intKeys_.size() * sizeof(int64_t)
+            + keyIds_.size() * sizeof(uint32_t) + idsByteSize_ + keyBytes_.size()
+            + keyOffsets_.size() * sizeof(size_t);
+    }
+
+    // The returned view is valid until the next call
+    RowView row(size_t idx) { return useLocations_ ? input_.rowAt(locations_[idx]) : rows_[idx]; }
+
+    // Indices of the rows in sorted order. Rows with equal keys keep their order.
+    // If the rows are sorted already (which is checked first), the order is returned right away.
+    std::vector<size_t> order(size_t threads) const
+    {
+        std::vector<size_t> order(size_);
+        std::iota(order.begin(), order.end(), 0);
+
+        const auto descending = keys_[0].descending;
+        if (singleIntKey_) {
+            // Flipping the sign bit makes the keys sort correctly as unsigned integers and
+            // inverting all bits reverses the order, without changing the order of equal keys.
+            std::vector<uint64_t> keys(intKeys_.size());
+            const auto mask = descending ? ~(uint64_t(1) << 63) : uint64_t(1) << 63;
+            for (size_t i = 0; i < keys.size(); ++i) {
+                keys[i] = static_cast<uint64_t>(intKeys_[i]) ^ mask;
+            }
+            if (std::is_sorted(keys.begin(), keys.end())) {
+                return order;
+            }
+            return radixSortOrder(keys);
+        }
+
+        if (useRanks_) {
+            std::vector<uint32_t> byString(distinct_.size());
+            std::iota(byString.begin(), byString.end(), 0);
+            std::sort(byString.begin(), byString.end(),
+                [this](uint32_t a, uint32_t b) { return *distinct_[a] < *distinct_[b]; });
+            std::vector<uint32_t> ranks(distinct_.size());
+            for (size_t i = 0; i < byString.size(); ++i) {
+                ranks[byString[i]] = i;
+            }
+
+            auto less = [&](size_t a, size_t b) {
+                const auto rankA = ranks[keyIds_[a]];
+                const auto rankB = ranks[keyIds_[b]];
+                return descending ? rankB < rankA : rankA < rankB;
+            };
+            if (!std::is_sorted(order.begin(), order.end(), less)) {
+                parallelStableSort(order, less, threads);
+            }
+            return order;
+        }
+
+        const auto key = [this](size_t idx) {
+            return std::string_view(keyBytes_).substr(
+                keyOffsets_[idx], keyOffsets_[idx + 1] - keyOffsets_[idx]);
+        };
+        for (size_t i = 1; i < size_; ++i) {
+            if (compareKeys(key(i - 1), key(i)) > 0) {
+                return keyOrder(keyBytes_, keyOffsets_, threads);
+            }
+        }
+        return order;
+    }
+
+private:
+    // If the key column is dictionary encoded, each distinct string is given an id once per
+    // dictionary and the ids are ranked after reading, so sorting only compares integers.
+    void pushRank(const RowView& row)
+    {
+        const auto keyIdx = keys_[0].column;
+        const auto cached = codeIds_.find(row, keyIdx);
+        if (!cached) {
+            // Encode the keys of all rows so far, which is done for all later rows too
+            useRanks_ = false;
+            for (size_t i = 0; i < size_; ++i) {
+                appendKey(keyBytes_, i + 1 < size_ ? this->row(i) : row, keys_);
+                keyOffsets_.push_back(keyBytes_.size());
+            }
+            keyIds_ = {};
+            ids_ = {};
+            distinct_ = {};
+            idsByteSize_ = 0;
+            return;
+        }
+        if (!*cached) {
+            const auto [it, inserted]
+                = ids_.emplace(std::string(row.str(keyIdx)), static_cast<uint32_t>(ids_.size()));
+            if (inserted) {
+                distinct_.push_back(&it->first);
+                idsByteSize_ += it->first.capacity() + sizeof(*it) + sizeof(void*);
+            }
+            *cached = it->second;
+        }
+        keyIds_.push_back(**cached);
+    }
+
+    Input& input_;
+    std::vector<SortKey> keys_;
+    RowArena rows_;
+    std::vector<RowLocation> locations_;
+    bool useLocations_;
+    size_t size_ = 0;
+    // Only one integer key
+    bool singleIntKey_;
+    std::vector<int64_t> intKeys_;
+    // Only one string key, which is dictionary encoded so far
+    bool useRanks_;
+    std::vector<uint32_t> keyIds_;
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::vector<const std::string*> distinct_;
+    size_t idsByteSize_ = 0;
+    DictionaryCache<uint32_t> codeIds_;
+    // Encoded keys of all rows otherwise
+    std::string keyBytes_;
+    std::vector<size_t> keyOffsets_ { 0 };
+};
+
+// Outputs the first `limit` rows in sorted order, keeping only that many rows in memory
+void sortLimited(Input& input, Output& output, const std::vector<SortKey>& keys, size_t limit)
+{
+    if (limit == 0) {
+        return;
+    }
+    // Rows are numbered in input order, so equal keys keep their order
+    struct Entry {
+        std::string key;
+        size_t index;
+        std::vector<Value> row;
+
+        bool operator<(const Entry& other) const
+        {
+            const auto cmp = compareKeys(key, other.key);
+            return cmp < 0 || (cmp == 0 && index < other.index);
+        }
+    };
+    // A max-heap, so the last of the rows kept so far is on top and can be replaced
+    std::vector<Entry> heap;
+    std::string key;
+    size_t index = 0;
+    while (const auto row = input.rowView()) {
+        key.clear();
+        appendKey(key, *row, keys);
+        if (heap.size() < limit) {
+            heap.push_back(Entry { key, index++, row->values() });
+            std::push_heap(heap.begin(), heap.end());
+            continue;
+        }
+        // A later row with an equal key comes after the top row, so it is not taken
+        if (compareKeys(key, heap.front().key) >= 0) {
+            index++;
+            continue;
+        }
+        std::pop_heap(heap.begin(), heap.end());
+        auto& entry = heap.back();
+        entry.key.swap(key);
+        entry.index = index++;
+        entry.row = row->values();
+        std::push_heap(heap.begin(), heap.end());
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+    for (const auto& entry : heap) {
+        output.row(entry.row);
+    }
+}
+
+// The file is deleted right away, so it goes away with the process
+int createTempFile()
+{
+    const auto tmpDir = std::getenv("TMPDIR");
+    auto path = std::string(tmpDir && *tmpDir ? tmpDir : "/tmp") + "/jsort-XXXXXX";
+    const auto fd = ::mkstemp(path.data());
+    if (fd < 0) {
+        std::cerr << "Could not create temporary file '" << path << "': " << std::strerror(errno)
+                  << std::endl;
+        std::exit(1);
+    }
+    ::unlink(path.c_str());
+    return fd;
+}
+
+// Writes the sorted chunk to a temporary file and returns its file descriptor
+int writeRun(const std::vector<Column>& columns, Chunk& chunk, size_t threads)
+{
+    const auto fd = createTempFile();
+    {
+        Output output(columns, {}, fd);
+        for (const auto i : chunk.order(threads)) {
+            output.row(chunk.row(i));
+        }
+    }
+    ::lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// Merges sorted runs that each contain a contiguous part of the input
+void mergeRuns(const std::vector<int>& runFds, Output& output, const std::vector<SortKey>& keys)
+{
+    std::vector<std::unique_ptr<Input>> runs;
+    std::vector<std::optional<RowView>> heads;
+    // The encoded key of each head
+    std::vector<std::string> headKeys(runFds.size());
+    auto next = [&](size_t run) {
+        heads[run] = runs[run]->rowView();
+        if (heads[run]) {
+            headKeys[run].clear();
+            appendKey(headKeys[run], *heads[run], keys);
+        }
+    };
+    for (const auto fd : runFds) {
+        runs.push_back(std::make_unique<Input>(fd));
+        heads.emplace_back();
+        next(runs.size() - 1);
+    }
+
+    // The heap puts the greatest element first, so this orders the runs the other way around.
+    // Equal keys are taken from the earlier run first, which keeps the sort stable.
+    auto after = [&](size_t a, size_t b) {
+        const auto cmp = compareKeys(headKeys[a], headKeys[b]);
+        return cmp > 0 || (cmp == 0 && a > b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(after)> queue(after);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (heads[i]) {
+            queue.push(i);
+        }
+    }
+
+    while (!queue.empty()) {
+        const auto run = queue.top();
+        queue.pop();
+        output.row(*heads[run]);
+        next(run);
+        if (heads[run]) {
+            queue.push(run);
+        }
     }
 }
 }
 
 int sort(int argc, char** argv)
 {
+    std::vector<std::pair<std::string, bool>> keyArgs;
+    const auto flags = extractKeys(argc, argv, keyArgs);
     auto parser = clipp::Parser(argv[0]);
-    const auto args = parser.parse<SortArgs>(argc, argv).value();
+    const auto args = parser.parse<SortArgs>(flags).value();
+    if (keyArgs.empty()) {
+        std::cerr << "Missing key column" << std::endl;
+        return 1;
+    }
 
-    Input input;
+    std::optional<size_t> memoryLimit;
+    if (args.memoryLimit) {
+        memoryLimit = parseSize(*args.memoryLimit);
+        if (!memoryLimit || *memoryLimit == 0) {
+            std::cerr << "Invalid memory limit: " << *args.memoryLimit << std::endl;
+            return 1;
+        }
+    }
 
-    const auto idx = getColumnIndex(input.columns(), args.column);
-    if (!idx) {
-        std::cerr << "Invalid column" << std::endl;
+    if (*args.threads < 0) {
+        std::cerr << "Invalid number of threads" << std::endl;
+        return 1;
+    }
+    if (args.limit && *args.limit < 0) {
+        std::cerr << "Invalid limit" << std::endl;
         return 1;
     }
 
-    Output output(input.columns());
+    const auto threads = *args.threads > 0
+        ? static_cast<size_t>(*args.threads)
+        : std::max<size_t>(1, std::thread::hardware_concurrency());
 
-    std::vector<std::vector<Value>> rows = input.rows();
+    Input input;
+
+    std::vector<SortKey> keys;
+    for (const auto& [name, descending] : keyArgs) {
+        const auto idx = getColumnIndex(input.columns(), name);
+        if (!idx) {
+            std::cerr << "Invalid column: " << name << std::endl;
+            return 1;
+        }
+        keys.push_back(SortKey { *idx, descending != args.reverse });
+    }
+
+    Output output(input.columns(), keys);
+
+    // If the header says that the input is sorted by the requested keys already (or by more
+    // keys, starting with them), there is nothing to do
+    const auto& sortedBy = input.sortedBy();
+    const auto sorted = sortedBy.size() >= keys.size()
+        && std::equal(keys.begin(), keys.end(), sortedBy.begin(), [](const auto& a, const auto& b) {
+               return a.column == b.column && a.descending == b.descending;
+           });
+    if (sorted) {
+        if (args.limit) {
+            for (int64_t i = 0; i < *args.limit; ++i) {
+                const auto row = input.rowView();
+                if (!row) {
+                    break;
+                }
+                output.row(*row);
+            }
+        } else {
+            output.copyRest(input);
+        }
+        return 0;
+    }
 
-    std::stable_sort(rows.begin(), rows.end(),
-        [idx = idx.value(), reverse = args.reverse](const auto& a, const auto& b) {
-            const auto less = compare(a[idx], b[idx]);
-            return reverse ? !less : less;
-        });
+    if (args.limit) {
+        sortLimited(input, output, keys, *args.limit);
+        return 0;
+    }
+
+    auto chunk = std::make_unique<Chunk>(input, keys);
+    std::vector<int> runFds;
+    while (const auto row = input.rowView()) {
+        chunk->push(*row);
+        if (memoryLimit && chunk->byteSize() >= *memoryLimit) {
+            runFds.push_back(writeRun(input.columns(), *chunk, threads));
+            chunk = std::make_unique<Chunk>(input, keys);
+        }
+    }
 
-    for (const auto& row : rows) {
-        output.row(row);
+    if (runFds.empty()) {
+        for (const auto i : chunk->order(threads)) {
+            output.row(chunk->row(i));
+        }
+        return 0;
+    }
+
+    if (chunk->size() > 0) {
+        runFds.push_back(writeRun(input.columns(), *chunk, threads));
+    }
+    chunk.reset();
+    mergeRuns(runFds, output, keys);
+    for (const auto fd : runFds) {
+        ::close(fd);
     }
 
     return 0;
@@ -1,5 +1,7 @@
 #include "util.hpp"
 
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 
 #include <fcntl.h>
@@ -43,3 +45,73 @@ std::optional<std::string> readFile(const std::string& path)
     }
     return ret;
 }
+
+std::optional<size_t> parseSize(std::string_view str)
+{
+    size_t size = 0;
+    const auto res = std::from_chars(str.data(), str.data() + str.size(), size);
+    if (res.ec != std::errc()) {
+        return std::nullopt;
+    }
+    const auto suffix = str.substr(res.ptr - str.data());
+    if (suffix.empty()) {
+        return size;
+    } else if (suffix == "K") {
+        return size << 10;
+    } else if (suffix == "M") {
+        return size << 20;
+    } else if (suffix == "G") {
+        return size << 30;
+    }
+    return std::nullopt;
+}
+
+Projection::Projection(const std::vector<Column>& columns, const std::optional<std::string>& names)
+    : all_(columns)
+    , needed_(columns.size(), !names)
+{
+    if (!names) {
+        columns_ = columns;
+        return;
+    }
+    size_t start = 0;
+    while (start <= names->size()) {
+        const auto end = std::min(names->find(',', start), names->size());
+        const auto name = names->substr(start, end - start);
+        const auto idx = getColumnIndex(columns, name);
+        if (!idx) {
+            std::cerr << "Invalid column: " << name << std::endl;
+            std::exit(3);
+        }
+        indices_.push_back(*idx);
+        columns_.push_back(columns[*idx]);
+        needed_[*idx] = true;
+        start = end + 1;
+    }
+}
+
+void Projection::use(const std::vector<bool>& used)
+{
+    for (size_t i = 0; i < used.size(); ++i) {
+        needed_[i] = needed_[i] || used[i];
+    }
+}
+
+bool Projection::needs(const std::string& column) const
+{
+    const auto idx = getColumnIndex(all_, column);
+    return idx && needed_[*idx];
+}
+
+std::vector<Value> Projection::apply(std::vector<Value> values) const
+{
+    if (indices_.empty()) {
+        return values;
+    }
+    std::vector<Value> projected;
+    projected.reserve(indices_.size());
+    for (const auto idx : indices_) {
+        projected.push_back(values[idx]);
+    }
+    return projected;
+}
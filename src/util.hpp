@@ -5,3 +5,29 @@
 std::optional<size_t> getColumnIndex(const std::vector<Column>& columns, const std::string& column);
 std::string toString(const Value& val);
 std::optional<std::string> readFile(const std::string& path);
+// A number of bytes with an optional K, M or G suffix (e.g. 512M)
+std::optional<size_t> parseSize(std::string_view str);
+
+// The columns a producer outputs (--columns) and the ones it has to compute for them and --where.
+class Projection {
+public:
+    // `names` is a comma separated list of the columns to output, in that order. All columns are
+    // output if it's not given. Exits with an error message if a column doesn't exist.
+    Projection(const std::vector<Column>& columns, const std::optional<std::string>& names);
+
+    const std::vector<Column>& columns() const { return columns_; }
+
+    // The `used` columns have to be computed as well, even if they are not output
+    void use(const std::vector<bool>& used);
+    // Whether the column exists and has to be computed
+    bool needs(const std::string& column) const;
+
+    // Picks the output columns from the values of all columns
+    std::vector<Value> apply(std::vector<Value> values) const;
+
+private:
+    std::vector<Column> all_;
+    std::vector<size_t> indices_;
+    std::vector<Column> columns_;
+    std::vector<bool> needed_;
+};
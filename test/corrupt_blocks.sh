@@ -0,0 +1,96 @@
+#!/bin/sh
+# Feeds blocks whose header claims 0xffffffff rows, but whose payload only holds two, to the tools
+# that decode them. Every column encoding has to be rejected as a malformed block (instead of e.g.
+# allocating memory for all the claimed rows first).
+#
+# Usage: test/corrupt_blocks.sh [directory with the jutils symlinks]
+
+bin=${1:-.}
+failed=0
+
+# Stream header of version 2 with a single column: type (1 = integer, 2 = string) and name "c"
+header() {
+    printf '\351SIO\377\377\377\377\002\000\000\000\000\001\000\000\000'
+    printf "\\00$1\\001\\000c"
+}
+
+# Block header with 0xffffffff rows and a payload of $1 bytes
+block() {
+    printf '\351BLK\377\377\377\377'"\\$(printf %03o "$1")"'\000\000\000'
+}
+
+check() {
+    name=$1
+    shift
+    for tool in "jselect c" "jsort c" "jfilter c == 1"; do
+        err=$("$@" | "$bin"/$tool 2>&1 >/dev/null)
+        status=$?
+        case "$err" in
+        *"malformed block"*)
+            [ $status -eq 1 ] && continue
+            ;;
+        esac
+        echo "FAIL: $name with $tool (exit status $status): $err"
+        failed=1
+    done
+}
+
+i64_plain() {
+    header 1
+    block 17
+    printf '\000\001\000\000\000\000\000\000\000\002\000\000\000\000\000\000\000'
+}
+
+i64_varint() {
+    header 1
+    block 3
+    printf '\002\002\004'
+}
+
+i64_delta_varint() {
+    header 1
+    block 3
+    printf '\003\002\002'
+}
+
+string_plain() {
+    header 2
+    block 15
+    printf '\000\000\000\000\000\001\000\000\000\002\000\000\000ab'
+}
+
+string_dictionary() {
+    header 2
+    block 18
+    printf '\001\001\000\000\000\000\000\000\000\001\000\000\000a\000\000\000\000'
+}
+
+# A compressed block whose header claims a decompressed size of 0xffffffff bytes for a payload of
+# three bytes. It has to be rejected before allocating the decompressed size, which fails with the
+# limited address space.
+compressed_size() {
+    printf '\351SIO\377\377\377\377\002\001\000\000\000\001\000\000\000\001\001\000c'
+    printf '\351BLK\002\000\000\000\003\000\000\000\377\377\377\377'
+    printf '\020\000\000'
+}
+
+for tool in "jselect c" "jsort c" "jfilter c == 1"; do
+    err=$(compressed_size | (ulimit -v 1000000 && "$bin"/$tool 2>&1 >/dev/null))
+    status=$?
+    case "$err" in
+    *"malformed compressed block"*)
+        [ $status -eq 1 ] && continue
+        ;;
+    esac
+    echo "FAIL: compressed size with $tool (exit status $status): $err"
+    failed=1
+done
+
+check "plain integers" i64_plain
+check "varints" i64_varint
+check "delta varints" i64_delta_varint
+check "plain strings" string_plain
+check "dictionary strings" string_dictionary
+
+[ $failed -eq 0 ] && echo "All corrupt blocks were rejected"
+exit $failed
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Parses CSV lines with empty, whitespace-only and trailing fields with `jparse --trim` and
+# compares the result to parsing the same lines trimmed beforehand.
+#
+# Usage: test/parse_trim.sh [directory with the jutils symlinks]
+
+bin=${1:-.}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf ' a ;b\t;\nd; ;f\n;;\n  ; g;\n' | "$bin"/jparse -c ';' -t x y z > "$tmp/trimmed"
+status=$?
+printf 'a;b;\nd;;f\n;;\n;g;\n' | "$bin"/jparse -c ';' x y z > "$tmp/expected"
+
+if [ $status -ne 0 ] || ! cmp -s "$tmp/trimmed" "$tmp/expected"; then
+    echo "FAIL: jparse --trim (exit status $status)"
+    exit 1
+fi
+echo "All fields were trimmed"